@@ -0,0 +1,446 @@
+// echo benchmark suite: fixed scenarios rendered into a counting sink, no tty needed.
+// one JSON object per scenario on stdout, so runs can be diffed across commits:
+//   ./bench [--frames N] [--filter substring]
+#include "echo.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <barrier>
+#include <new>
+
+// ----------------- ALLOCATION COUNTING -----------------
+namespace {
+    std::atomic<uint64_t> allocations{0};
+}
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, std::align_val_t align)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t a = static_cast<size_t>(align);
+    if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t size, std::align_val_t align) { return operator new(size, align); }
+// every operator new above is malloc/aligned_alloc underneath, which GCC cannot see through when it pairs them
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+    using namespace echo;
+
+    constexpr int term_w = 200, term_h = 60;
+
+    // throws the bytes away, keeps the numbers
+    class CountingSink : public Sink
+    {
+    private:
+        uint64_t escapes = 0;
+
+    protected:
+        void emit(const char *data, size_t size) override
+        {
+            for (const char *p = data; (p = static_cast<const char *>(std::memchr(p, '\033', data + size - p))); p++)
+                escapes++;
+        }
+
+    public:
+        std::pair<int, int> size() const override { return {term_w, term_h}; }
+        uint64_t escape_count() const { return escapes; }
+        void reset()
+        {
+            reset_counters();
+            escapes = 0;
+        }
+    };
+
+    struct Options
+    {
+        int frames = 200;
+        const char *filter = "";
+    };
+
+    // times `frames` calls of frame(i) and prints one result line
+    template <typename Frame>
+    void measure(const Options &opt, const char *name, CountingSink &sink, Frame &&frame)
+    {
+        if (!std::strstr(name, opt.filter))
+            return;
+        frame(0); // warm-up: first-touch allocations and the initial full paint are not what we track
+        sink.reset();
+        uint64_t allocs_before = allocations.load();
+
+        auto start = steady_clock::now();
+        for (int i = 1; i <= opt.frames; i++)
+            frame(i);
+        double ns = duration<double, std::nano>(steady_clock::now() - start).count();
+
+        double n = opt.frames;
+        std::printf("{\"scenario\":\"%s\",\"frames\":%d,\"ns_per_frame\":%.0f,\"bytes_per_frame\":%.1f,"
+                    "\"escapes_per_frame\":%.1f,\"writes_per_frame\":%.2f,\"allocs_per_frame\":%.2f}\n",
+                    name, opt.frames, ns / n, sink.bytes_written() / n, sink.escape_count() / n,
+                    sink.write_count() / n, (allocations.load() - allocs_before) / n);
+        std::fflush(stdout);
+    }
+
+    // times a recorded window against a plain twin drawing the same frames, in alternating blocks so both see the same
+    // machine; back to back runs drift by more than recording costs. runs for at least a second of recorded frames, so
+    // the recorder's writer takes and encodes many times over. frame(recorded, i) draws frame i into one of the two
+    template <typename Frame>
+    void measure_recorded(const Options &opt, const char *name, CountingSink &sink, CountingSink &twin_sink, Frame &&frame)
+    {
+        if (!std::strstr(name, opt.filter))
+            return;
+        frame(true, 0);
+        frame(false, 0);
+        sink.reset();
+        twin_sink.reset();
+        uint64_t allocs_before = allocations.load();
+
+        constexpr int block = 10;
+        double ns[2] = {0, 0}; // plain, recorded
+        int frames = 0;
+        while (frames < opt.frames || ns[1] < 1e9)
+        {
+            for (int k = 0; k < 2; k++)
+            {
+                bool recorded = (k + frames / block) % 2; // who goes first alternates too
+                auto start = steady_clock::now();
+                for (int i = 1; i <= block; i++)
+                    frame(recorded, frames + i);
+                ns[recorded] += duration<double, std::nano>(steady_clock::now() - start).count();
+            }
+            frames += block;
+        }
+
+        double n = frames;
+        std::printf("{\"scenario\":\"%s\",\"frames\":%d,\"ns_per_frame\":%.0f,\"bytes_per_frame\":%.1f,"
+                    "\"escapes_per_frame\":%.1f,\"writes_per_frame\":%.2f,\"allocs_per_frame\":%.2f,"
+                    "\"plain_ns_per_frame\":%.0f,\"overhead_pct\":%.1f}\n",
+                    name, frames, ns[1] / n, sink.bytes_written() / n, sink.escape_count() / n, sink.write_count() / n,
+                    (allocations.load() - allocs_before) / n, ns[0] / n, 100 * (ns[1] / ns[0] - 1));
+        std::fflush(stdout);
+    }
+
+    // ----------------- SCENARIOS -----------------
+    void render_scenarios(const Options &opt)
+    {
+        CountingSink sink;
+        Window win(1, 1, term_w, term_h, "bench", sink);
+        int w = win.get_w(), h = win.get_h();
+
+        std::vector<COLOR> palette;
+        std::mt19937 rng(1);
+        for (int k = 0; k < 64; k++)
+            palette.emplace_back(rng() % 256, rng() % 256, rng() % 256);
+
+        measure(opt, "render_static", sink, [&](int) { win.render(); });
+
+        auto churn = [&](Window &target, int f) {
+            for (int r = 0; r < h; r++)
+                for (int c = 0; c < w; c++)
+                    target.set_cell(r, c, char('a' + (r + c + f) % 26), palette[(r * 7 + c + f) & 63]);
+            target.render();
+        };
+        // about 1% of the cells change per frame, scattered
+        auto sparse = [&](Window &target, int f) {
+            std::mt19937 pick(f);
+            for (int k = 0; k < w * h / 100; k++)
+                target.set_cell(pick() % h, pick() % w, char('a' + f % 26), palette[f & 63]);
+            target.render();
+        };
+        measure(opt, "render_full_churn", sink, [&](int f) { churn(win, f); });
+        measure(opt, "render_sparse", sink, [&](int f) { sparse(win, f); });
+
+        // the same two with a Recorder attached, each against a plain twin: overhead_pct is what recording costs per frame
+        CountingSink twin_sink;
+        Window twin(1, 1, term_w, term_h, "bench", twin_sink);
+        Recorder rec("bench.rec", term_w, term_h);
+        win.record(&rec);
+        // the writer's first take learns the palette and sizes its buffers, that is not steady state
+        for (int r = 0; r < h; r++)
+            for (int c = 0; c < w; c++)
+                win.set_cell(r, c, ' ', palette[(r * 7 + c) & 63]);
+        win.render();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        measure_recorded(opt, "render_full_churn_recorded", sink, twin_sink,
+                         [&](bool recorded, int f) { churn(recorded ? win : twin, f); });
+        measure_recorded(opt, "render_sparse_recorded", sink, twin_sink,
+                         [&](bool recorded, int f) { sparse(recorded ? win : twin, f); });
+        win.record(nullptr);
+        rec.close();
+        std::remove("bench.rec");
+    }
+
+    // a 4K-sized terminal fully repainted every frame: one encoding thread against row bands on default_pool()
+    void large_scenarios(const Options &opt)
+    {
+        CountingSink sink;
+        Window win(1, 1, 500, 150, "bench", sink);
+        int w = win.get_w(), h = win.get_h();
+
+        std::vector<COLOR> palette;
+        std::mt19937 rng(3);
+        for (int k = 0; k < 64; k++)
+            palette.emplace_back(rng() % 256, rng() % 256, rng() % 256);
+        auto churn = [&](int f) {
+            for (int r = 0; r < h; r++)
+                for (int c = 0; c < w; c++)
+                    win.set_cell(r, c, char('a' + (r + c + f) % 26), palette[(r * 7 + c + f) & 63]);
+            win.render();
+        };
+
+        win.set_parallel_encoding(false);
+        measure(opt, "render_large_churn_serial", sink, churn);
+        win.set_parallel_encoding(true);
+        measure(opt, "render_large_churn_banded", sink, churn);
+    }
+
+    void primitive_scenarios(const Options &opt)
+    {
+        CountingSink sink;
+        Window win(1, 1, term_w, term_h, "bench", sink);
+        int w = win.get_w(), h = win.get_h();
+
+        std::mt19937 rng(2);
+        std::vector<std::array<int, 4>> lines(500);
+        for (auto &l : lines)
+            l = {int(rng() % (w * 2)) - w / 2, int(rng() % (h * 2)) - h / 2, int(rng() % (w * 2)) - w / 2, int(rng() % (h * 2)) - h / 2};
+
+        measure(opt, "draw_line_500", sink, [&](int f) {
+            win.clean_buffer();
+            int shift = f % 40 - 20; // the whole set slides sideways, so every frame differs
+            for (auto &l : lines)
+                Visualizer::Primitive::draw_line(win, l[0] + shift, l[1], l[2] + shift, l[3], COLOR(COLOR::CYAN), '*');
+            win.render();
+        });
+
+        std::vector<int> heights(w / 2);
+        std::vector<COLOR> bar_colors(heights.size(), COLOR(COLOR::GREEN));
+        measure(opt, "draw_bars", sink, [&](int f) {
+            for (size_t k = 0; k < heights.size(); k++)
+                heights[k] = static_cast<int>((std::sin((k + f) * 0.1) * 0.5 + 0.5) * h);
+            Visualizer::Plots::draw_bars(win, heights, 2, bar_colors);
+            win.render();
+        });
+
+        std::vector<char> chars(w * h);
+        std::vector<COLOR> colors(w * h);
+        measure(opt, "draw_frame", sink, [&](int f) {
+            for (int r = 0; r < h; r++)
+                for (int c = 0; c < w; c++)
+                {
+                    int v = (r * 3 + c + f * 2) & 255;
+                    chars[r * w + c] = " .:-=+*#%@"[v * 10 / 256];
+                    colors[r * w + c] = COLOR(uint8_t(v), uint8_t(255 - v), 128);
+                }
+            Visualizer::Plots::draw_frame(win, chars, colors);
+            win.render();
+        });
+    }
+
+    // a latitude/longitude sphere with roughly `edges` edges
+    void sphere(int edges, std::vector<ThreeD::Point3D> &verts, std::vector<std::pair<int, int>> &out)
+    {
+        int n = (std::max)(3, static_cast<int>(std::sqrt(edges / 2.0)));
+        verts.clear();
+        out.clear();
+        for (int i = 0; i <= n; i++)
+            for (int j = 0; j < n; j++)
+            {
+                float th = 3.14159265f * i / n, ph = 6.2831853f * j / n;
+                verts.emplace_back(10 * std::sin(th) * std::cos(ph), 10 * std::cos(th), 10 * std::sin(th) * std::sin(ph));
+            }
+        for (int i = 0; i <= n; i++)
+            for (int j = 0; j < n; j++)
+            {
+                int a = i * n + j;
+                out.emplace_back(a, i * n + (j + 1) % n);
+                if (i < n)
+                    out.emplace_back(a, a + n);
+            }
+    }
+
+    void wireframe_scenarios(const Options &opt)
+    {
+        using namespace ThreeD;
+        CountingSink sink;
+        Window win(1, 1, term_w, term_h, "bench", sink);
+        win.enable_depth();
+        Camera cam(Point3D(0, 0, -30), Point3D(0, 0, 0));
+
+        std::vector<Point3D> verts, moved;
+        std::vector<std::pair<int, int>> edges;
+        for (int size : {100, 1000, 10000})
+        {
+            sphere(size, verts, edges);
+            moved.resize(verts.size());
+            char name[64];
+            std::snprintf(name, sizeof(name), "wireframe_%d", size);
+            measure(opt, name, sink, [&](int f) {
+                Mat4 model = Mat4::rotate_y(f * 2.0f) * Mat4::rotate_x(f * 1.0f);
+                for (size_t k = 0; k < verts.size(); k++)
+                    moved[k] = model * verts[k];
+                win.clean_buffer();
+                for (auto &e : edges)
+                    Visualizer::ThreeD::draw_line3D(win, cam, moved[e.first], moved[e.second], COLOR(COLOR::CYAN), '*');
+                win.render();
+            });
+        }
+    }
+
+    // the same sphere as closed quads, so draw_mesh has faces to cull by; wound counter-clockwise seen from outside
+    void sphere_mesh(int edges, ThreeD::VertexBatch &verts, std::vector<std::vector<int>> &quads)
+    {
+        std::vector<ThreeD::Point3D> points;
+        std::vector<std::pair<int, int>> unused;
+        sphere(edges, points, unused);
+        int n = (std::max)(3, static_cast<int>(std::sqrt(edges / 2.0)));
+        verts = ThreeD::VertexBatch(points);
+        quads.clear();
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+            {
+                int k = (j + 1) % n;
+                quads.push_back({i * n + j, i * n + k, (i + 1) * n + k, (i + 1) * n + j});
+            }
+    }
+
+    void mesh_scenarios(const Options &opt)
+    {
+        using namespace ThreeD;
+        CountingSink sink;
+        Window win(1, 1, term_w, term_h, "bench", sink);
+        win.enable_depth();
+        Camera cam(Point3D(0, 0, -30), Point3D(0, 0, 0));
+
+        VertexBatch verts;
+        std::vector<std::vector<int>> quads;
+        for (int size : {10000, 100000})
+        {
+            sphere_mesh(size, verts, quads);
+            Mesh mesh(verts, {}, quads);
+            MeshScratch scratch;
+            char name[64];
+            std::snprintf(name, sizeof(name), "mesh_%d", size);
+            measure(opt, name, sink, [&](int f) {
+                win.clean_buffer();
+                Visualizer::ThreeD::draw_mesh(win, cam, Mat4::rotate_y(f * 2.0f) * Mat4::rotate_x(f * 1.0f), mesh, scratch, COLOR(COLOR::CYAN), '*');
+                win.render();
+            });
+        }
+    }
+
+    void screen_scenarios(const Options &opt)
+    {
+        CountingSink sink;
+        {
+            Screen screen(0, 0, sink);
+            std::vector<Window *> wins;
+            for (int k = 0; k < 48; k++)
+                wins.push_back(&screen.add_window((k % 8) * 24 + 1, (k / 8) * 9 + 1, 30, 12, "w" + std::to_string(k), k));
+
+            measure(opt, "many_windows_48", sink, [&](int f) {
+                for (size_t k = 0; k < wins.size(); k++)
+                    for (int c = 0; c < 10; c++)
+                        wins[k]->set_cell((f + c) % wins[k]->get_h(), (f * 3 + c) % wins[k]->get_w(), char('a' + (f + k) % 26));
+                screen.render();
+            });
+        }
+
+        // four threads each drawing their own window while the screen's render thread composes at 1ms;
+        // frame counts are per producer frame, so this measures what producers pay
+        CountingSink threaded;
+        {
+            Screen screen(0, 0, threaded);
+            std::vector<Window *> wins;
+            for (int k = 0; k < 4; k++)
+                wins.push_back(&screen.add_window((k % 2) * 100 + 1, (k / 2) * 30 + 1, 100, 30, "p" + std::to_string(k), k));
+            screen.start(std::chrono::milliseconds(1));
+
+            // the producers live for the whole scenario, each frame is one trip through the barrier to start and one to finish
+            int frame = 0;
+            bool done = false;
+            std::barrier sync(static_cast<std::ptrdiff_t>(wins.size() + 1));
+            std::vector<std::thread> producers;
+            for (Window *win : wins)
+                producers.emplace_back([&, win] {
+                    for (;;)
+                    {
+                        sync.arrive_and_wait();
+                        if (done)
+                            return;
+                        for (int r = 0; r < win->get_h(); r++)
+                            for (int c = 0; c < win->get_w(); c++)
+                                win->set_cell(r, c, char('a' + (r + c + frame) % 26));
+                        win->render();
+                        sync.arrive_and_wait();
+                    }
+                });
+
+            measure(opt, "producers_4", threaded, [&](int f) {
+                if (f == 0)
+                    return;
+                frame = f;
+                sync.arrive_and_wait();
+                sync.arrive_and_wait();
+            });
+            done = true;
+            sync.arrive_and_wait();
+            for (std::thread &t : producers)
+                t.join();
+            screen.stop();
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!std::strcmp(argv[i], "--frames") && i + 1 < argc)
+            opt.frames = (std::max)(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--filter") && i + 1 < argc)
+            opt.filter = argv[++i];
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--frames N] [--filter substring]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // nothing may reach the real terminal, not even the cursor helpers
+    CountingSink quiet;
+    set_default_sink(quiet);
+
+    render_scenarios(opt);
+    large_scenarios(opt);
+    primitive_scenarios(opt);
+    wireframe_scenarios(opt);
+    mesh_scenarios(opt);
+    screen_scenarios(opt);
+    return 0;
+}
@@ -2,30 +2,72 @@
 
 #include <iostream>
 #include <string>
-#include <sstream>
 #include <string_view>
+#include <array>
 #include <random>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
 #include <climits>
 #include <cassert>
+#include <cstdint>
+#include <new>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <deque>
+#include <unordered_map>
+#include <cstdio>
+#include <cctype>
+#include <charconv>
 
 #ifdef _WIN32
     #include <windows.h>
 #else
     #include <sys/ioctl.h>
     #include <unistd.h>
+    #include <poll.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/uio.h>
+    #include <termios.h>
+    #include <csignal>
+#endif
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <sys/timerfd.h>
+    #include <sys/eventfd.h>
 #endif
 
 using namespace std::chrono;
 
-inline std::chrono::milliseconds operator ""_FPS(unsigned long long fps) {
-        if (fps <= 0)   throw std::invalid_argument("\nERROR: FPS must be a positive integer (0, 60]");
-        if (fps > 60)   throw std::invalid_argument("\nERROR: FPS are capped at 60 FPS");
-        
-        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::duration<double>(1.0 / fps));
+// build with -DECHO_ENABLE_STATS=1 to count what every frame costs; without it the counters and every call site compile away
+#ifndef ECHO_ENABLE_STATS
+    #define ECHO_ENABLE_STATS 0
+#endif
+#if ECHO_ENABLE_STATS
+    #define ECHO_STAT(...) __VA_ARGS__
+#else
+    #define ECHO_STAT(...)
+#endif
+
+// exact to the nanosecond, so 60_FPS is 16.67 ms and not 16
+inline std::chrono::nanoseconds operator ""_FPS(unsigned long long fps) {
+        if (fps == 0)   throw std::invalid_argument("\nERROR: FPS must be a positive integer");
+
+        return std::chrono::nanoseconds(1'000'000'000ULL / fps);
 }
 
 namespace echo
@@ -33,6 +75,122 @@ namespace echo
     inline int max_height = INT_MIN;
     inline std::mutex screen_lock;
 
+    namespace detail {
+        inline constexpr size_t cache_line = 64;
+
+        // keeps the framebuffer rows on cache line boundaries
+        template <typename T>
+        struct AlignedAllocator {
+            using value_type = T;
+
+            AlignedAllocator() noexcept = default;
+            template <typename U> AlignedAllocator(const AlignedAllocator<U>&) noexcept {}
+
+            T* allocate(size_t n) {
+                return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(cache_line)));
+            }
+            void deallocate(T* p, size_t) noexcept {
+                ::operator delete(p, std::align_val_t(cache_line));
+            }
+
+            template <typename U> bool operator==(const AlignedAllocator<U>&) const noexcept { return true; }
+            template <typename U> bool operator!=(const AlignedAllocator<U>&) const noexcept { return false; }
+        };
+
+        template <typename T>
+        using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+        // decimal text for every byte value, so colour and cursor parameters never go through to_string
+        struct Decimal { char text[3]; uint8_t len; };
+
+        inline constexpr std::array<Decimal, 256> decimals = [] {
+            std::array<Decimal, 256> table{};
+            for (int n = 0; n < 256; n++)
+            {
+                Decimal &d = table[n];
+                if (n >= 100) d.text[d.len++] = char('0' + n / 100);
+                if (n >= 10)  d.text[d.len++] = char('0' + n / 10 % 10);
+                d.text[d.len++] = char('0' + n % 10);
+            }
+            return table;
+        }();
+
+#ifndef _WIN32
+        // write(2) until everything is out, riding over signals, short writes and a non-blocking tty
+        inline void write_all(int fd, const char *data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t written = ::write(fd, data, size);
+                if (written > 0)
+                {
+                    data += written;
+                    size -= static_cast<size_t>(written);
+                }
+                else if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    pollfd pfd{fd, POLLOUT, 0};
+                    ::poll(&pfd, 1, -1);
+                }
+                else
+                {
+                    return; // terminal went away, nothing sensible left to do
+                }
+            }
+        }
+
+        // the same for pieces that belong together, gathered by writev(2) instead of being copied into one buffer
+        inline void write_all(int fd, const std::string_view *parts, size_t count)
+        {
+            constexpr int batch = 64;
+            iovec iov[batch];
+            size_t next = 0, done = 0; // first piece not fully written yet, and how much of it is
+            while (next < count)
+            {
+                int n = 0;
+                for (size_t k = next; k < count && n < batch; k++)
+                {
+                    size_t from = k == next ? done : 0;
+                    if (parts[k].size() > from)
+                        iov[n++] = {const_cast<char *>(parts[k].data() + from), parts[k].size() - from};
+                }
+                if (n == 0)
+                    return;
+
+                ssize_t written = ::writev(fd, iov, n);
+                if (written > 0)
+                {
+                    size_t left = static_cast<size_t>(written);
+                    while (next < count && left >= parts[next].size() - done)
+                    {
+                        left -= parts[next].size() - done;
+                        next++;
+                        done = 0;
+                    }
+                    done += left;
+                }
+                else if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    pollfd pfd{fd, POLLOUT, 0};
+                    ::poll(&pfd, 1, -1);
+                }
+                else
+                {
+                    return;
+                }
+            }
+        }
+#endif
+    }
+
     struct COLOR {
         static constexpr uint8_t RED = 0;
         static constexpr uint8_t GREEN = 1;
@@ -91,494 +249,6536 @@ namespace echo
         bool operator != (const COLOR& other) const { return r != other.r || g != other.g || b != other.b; }
     };
 
-    // --------------- GLOBAL HELPERS --------------
-    inline void hide_cursor() { std::cout << "\033[?25l"; }
-    inline void show_cursor(){ std::cout << "\033[?25h"; }
+    // how colours go out on the wire, pick the richest one the terminal understands
+    enum class ColorMode : uint8_t { TrueColor, Palette256, Palette16, Monochrome };
 
-    inline void reset_cursor() {
-        std::lock_guard<std::mutex> lock(screen_lock);
-        show_cursor();
-        std::cout << "\033[" << max_height << ";1H" << COLOR::asANSI(COLOR::RESET) << std::flush;
-    }
-    
-    inline void clear_screen() {
-        std::lock_guard<std::mutex> lock(screen_lock);
-        hide_cursor();
-        std::cout << "\033[2J\033[H" << std::flush;        
+    namespace detail {
+        // nearest palette entry for every colour quantised to 5 bits per channel
+        struct PaletteLUT
+        {
+            uint8_t xterm256[1 << 15];
+            uint8_t ansi16[1 << 15];
+        };
+
+        inline constexpr uint8_t ansi16_rgb[16][3] = {
+            {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0}, {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+            {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0}, {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+        };
+
+        inline const PaletteLUT& palette_lut()
+        {
+            static const PaletteLUT lut = [] {
+                static constexpr int cube[6] = {0, 95, 135, 175, 215, 255};
+                auto dist = [](int r0, int g0, int b0, int r1, int g1, int b1) {
+                    return (r0 - r1) * (r0 - r1) + (g0 - g1) * (g0 - g1) + (b0 - b1) * (b0 - b1);
+                };
+                auto nearest_level = [](int v) {
+                    int best = 0;
+                    for (int k = 1; k < 6; k++)
+                        if (std::abs(cube[k] - v) < std::abs(cube[best] - v))
+                            best = k;
+                    return best;
+                };
+
+                PaletteLUT table{};
+                for (int i = 0; i < (1 << 15); i++)
+                {
+                    int r = ((i >> 10) & 31) << 3 | 4, g = ((i >> 5) & 31) << 3 | 4, b = (i & 31) << 3 | 4;
+
+                    // 6x6x6 cube against the 24-step grey ramp
+                    int cr = nearest_level(r), cg = nearest_level(g), cb = nearest_level(b);
+                    int cube_dist = dist(r, g, b, cube[cr], cube[cg], cube[cb]);
+                    int grey_step = std::clamp(((r + g + b) / 3 - 8 + 5) / 10, 0, 23);
+                    int grey = 8 + 10 * grey_step;
+                    table.xterm256[i] = dist(r, g, b, grey, grey, grey) < cube_dist
+                        ? static_cast<uint8_t>(232 + grey_step)
+                        : static_cast<uint8_t>(16 + 36 * cr + 6 * cg + cb);
+
+                    int best = 0, best_dist = INT_MAX;
+                    for (int k = 0; k < 16; k++)
+                    {
+                        int d = dist(r, g, b, ansi16_rgb[k][0], ansi16_rgb[k][1], ansi16_rgb[k][2]);
+                        if (d < best_dist) { best_dist = d; best = k; }
+                    }
+                    table.ansi16[i] = static_cast<uint8_t>(best);
+                }
+                return table;
+            }();
+            return lut;
+        }
+
+        inline size_t lut_index(const COLOR &c) { return size_t(c.r >> 3) << 10 | size_t(c.g >> 3) << 5 | size_t(c.b >> 3); }
+
+        // what actually identifies a colour on the wire in each mode, equal codes look identical on screen
+        template <ColorMode M>
+        inline uint32_t color_code(const COLOR &c)
+        {
+            if constexpr (M == ColorMode::TrueColor)
+                return uint32_t(c.r) << 16 | uint32_t(c.g) << 8 | c.b;
+            else if constexpr (M == ColorMode::Palette256)
+                return palette_lut().xterm256[lut_index(c)];
+            else if constexpr (M == ColorMode::Palette16)
+                return palette_lut().ansi16[lut_index(c)];
+            else
+                return 0;
+        }
     }
 
-    inline std::pair<int, int> get_terminal_size() {
-#ifdef _WIN32
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
-        return { csbi.srWindow.Right - csbi.srWindow.Left + 1, csbi.srWindow.Bottom - csbi.srWindow.Top + 1 };
-#else
-        struct winsize w;
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-        return { w.ws_col, w.ws_row };
-#endif
+    // best guess from the environment: COLORTERM for 24-bit, TERM for 256 colours or a dumb terminal
+    inline ColorMode detect_color_mode()
+    {
+        const char *colorterm = std::getenv("COLORTERM");
+        if (colorterm && (std::string_view(colorterm) == "truecolor" || std::string_view(colorterm) == "24bit"))
+            return ColorMode::TrueColor;
+        const char *term = std::getenv("TERM");
+        if (!term || std::string_view(term) == "dumb")
+            return ColorMode::Monochrome;
+        if (std::string_view(term).find("256") != std::string_view::npos)
+            return ColorMode::Palette256;
+        return ColorMode::Palette16;
     }
 
+    // --------------- OUTPUT SINKS --------------
+    // where finished frames go; every Window and Screen writes through one, the terminal on stdout by default
+    class Sink
+    {
+    private:
+        uint64_t bytes = 0, writes = 0;
+
+    protected:
+        virtual void emit(const char *data, size_t size) = 0;
 
-    struct Cell
-    { // so that each cell can have its own character and color
-        char ch;
-        COLOR color;
+        // sinks that can gather override this, the rest get the pieces one after another
+        virtual void emit_parts(const std::string_view *parts, size_t count)
+        {
+            for (size_t k = 0; k < count; k++)
+                if (!parts[k].empty())
+                    emit(parts[k].data(), parts[k].size());
+        }
 
-        Cell(char ch = ' ', const COLOR& color = COLOR(COLOR::RESET)) : ch(ch), color(color) {}
+    public:
+        virtual ~Sink() = default;
 
-        bool operator==(const Cell &other) const { return ch == other.ch && color == other.color; }
-        bool operator!=(const Cell &other) const { return ch != other.ch || color != other.color; }
+        // callers hold screen_lock, so a sink never sees two writers at once
+        void write(std::string_view data)
+        {
+            if (data.empty())
+                return;
+            bytes += data.size();
+            writes++;
+            emit(data.data(), data.size());
+        }
 
-        friend std::ostream &operator<<(std::ostream &out, const Cell &cell)
+        // one frame in several pieces, still a single write
+        void write(const std::string_view *parts, size_t count)
         {
-            out << cell.color.asANSI() << cell.ch;
-            return out;
+            size_t total = 0;
+            for (size_t k = 0; k < count; k++)
+                total += parts[k].size();
+            if (total == 0)
+                return;
+            bytes += total;
+            writes++;
+            emit_parts(parts, count);
         }
+
+        // columns x rows, {0, 0} when the sink has no idea
+        virtual std::pair<int, int> size() const { return {0, 0}; }
+
+        uint64_t bytes_written() const { return bytes; }
+        uint64_t write_count() const { return writes; }
+        void reset_counters() { bytes = writes = 0; }
     };
 
-    class Window
+    // a file descriptor, normally the tty; on Windows output always goes to the console
+    class FdSink : public Sink
     {
     private:
-        int x, y;
-        int width, height;
-        int r, c;
+        int fd;
 
-        std::vector<std::vector<bool>> dirty; // to track modified cells for optimized rendering
-        std::vector<std::vector<Cell>> content;
+    protected:
+        void emit(const char *data, size_t size) override
+        {
+#ifdef _WIN32
+            std::cout.write(data, size);
+            std::cout.flush();
+#else
+            if (fd == STDOUT_FILENO)
+                std::cout.flush(); // anything already streamed to cout has to land first
+            detail::write_all(fd, data, size);
+#endif
+        }
+#ifndef _WIN32
+        void emit_parts(const std::string_view *parts, size_t count) override
+        {
+            if (fd == STDOUT_FILENO)
+                std::cout.flush();
+            detail::write_all(fd, parts, count);
+        }
+#endif
 
+    public:
+        explicit FdSink(int fd) : fd(fd) {}
 
-        // ----------------- CORE PRIMITIVES -----------------
-        void move_string_to_cell(int row_index, const std::string &msg, int start_col, const COLOR& color)
+        std::pair<int, int> size() const override
         {
-            size_t msg_length = msg.length();
-            size_t total_columns = content[row_index].size();
-
-            for (size_t i = 0; i < msg_length && (start_col + i) < total_columns; i++)
-            {
-                content[row_index][start_col + i] = Cell(msg[i], color);
-                dirty[row_index][start_col + i] = true;
-            }
+#ifdef _WIN32
+            CONSOLE_SCREEN_BUFFER_INFO csbi;
+            GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
+            return { csbi.srWindow.Right - csbi.srWindow.Left + 1, csbi.srWindow.Bottom - csbi.srWindow.Top + 1 };
+#else
+            struct winsize w{};
+            if (ioctl(fd, TIOCGWINSZ, &w) != 0)
+                return {0, 0};
+            return { w.ws_col, w.ws_row };
+#endif
         }
+    };
 
-        std::string_view trim_string(const std::string &msg, size_t max_length) {
-            if (msg.length() <= max_length)
-                return msg;
-            else
-                return std::string_view(msg.c_str(), max_length);
+    // everything in one growing string, for tests and for measuring frames
+    class MemorySink : public Sink
+    {
+    private:
+        std::string buffer;
+        int cols, rows;
+
+    protected:
+        void emit(const char *data, size_t size) override { buffer.append(data, size); }
+
+    public:
+        explicit MemorySink(int cols = 80, int rows = 24) : cols(cols), rows(rows) {}
+
+        std::pair<int, int> size() const override { return {cols, rows}; }
+        std::string_view contents() const { return buffer; }
+        void clear() { buffer.clear(); }
+    };
+
+    // a recording on disk, replay it with cat
+    class FileSink : public Sink
+    {
+    private:
+        FILE *file;
+        int cols, rows;
+
+    protected:
+        void emit(const char *data, size_t size) override { std::fwrite(data, 1, size, file); }
+
+    public:
+        explicit FileSink(const std::string &path, int cols = 80, int rows = 24) : cols(cols), rows(rows)
+        {
+            file = std::fopen(path.c_str(), "wb");
+            if (!file)
+                throw std::invalid_argument("\nERROR: Cannot open " + path + " for writing");
         }
+        ~FileSink() override { std::fclose(file); }
+        FileSink(const FileSink &) = delete;
+        FileSink &operator=(const FileSink &) = delete;
+
+        std::pair<int, int> size() const override { return {cols, rows}; }
+        void flush() { std::fflush(file); }
+    };
+
+    // hand every write to user code, e.g. a socket or a compressor
+    class CallbackSink : public Sink
+    {
+    private:
+        std::function<void(std::string_view)> fn;
+        int cols, rows;
+
+    protected:
+        void emit(const char *data, size_t size) override { fn(std::string_view(data, size)); }
+
+    public:
+        explicit CallbackSink(std::function<void(std::string_view)> fn, int cols = 80, int rows = 24)
+            : fn(std::move(fn)), cols(cols), rows(rows) {}
+
+        std::pair<int, int> size() const override { return {cols, rows}; }
+    };
 
-        void move_cursor(int cx, int cy) const
+    namespace detail {
+        inline Sink &stdout_sink()
         {
-            std::cout << "\033[" << cy << ";" << cx << "H";
+#ifdef _WIN32
+            static FdSink sink(1);
+#else
+            static FdSink sink(STDOUT_FILENO);
+#endif
+            return sink;
         }
+        inline std::atomic<Sink *> current_sink{nullptr};
+    }
+
+    // what new windows and screens write to when they are not given a sink of their own
+    inline Sink &default_sink()
+    {
+        Sink *sink = detail::current_sink.load(std::memory_order_acquire);
+        return sink ? *sink : detail::stdout_sink();
+    }
+    inline void set_default_sink(Sink &sink) { detail::current_sink.store(&sink, std::memory_order_release); }
+
+    // --------------- FRAME STATISTICS --------------
+    struct FrameStats
+    {
+        uint64_t frames = 0;
+        uint64_t dirty_cells = 0;     // cells written since the previous frame
+        uint64_t cells_emitted = 0;   // of those, the ones that really differed from the screen
+        uint64_t runs = 0;            // times output jumped to a new spot (a retyped gap is a run without a move)
+        uint64_t cursor_moves = 0;    // cursor escapes and CR/LF sequences emitted
+        uint64_t color_switches = 0;
+        uint64_t bytes = 0;
+        uint64_t encode_ns = 0, write_ns = 0, lock_wait_ns = 0;
+        uint64_t dropped_frames = 0;  // published but never shown, or skipped by a pacer
 
-        void clear_line(int px, int py) const
+        FrameStats &operator+=(const FrameStats &o)
         {
-            int cx = x + 1 + px;
-            int cy = y + 1 + py;
-            move_cursor(cx, cy);
-            std::cout << std::string(width - 2, ' ');
-            std::cout << std::flush;
+            frames += o.frames; dirty_cells += o.dirty_cells; cells_emitted += o.cells_emitted; runs += o.runs;
+            cursor_moves += o.cursor_moves; color_switches += o.color_switches; bytes += o.bytes;
+            encode_ns += o.encode_ns; write_ns += o.write_ns; lock_wait_ns += o.lock_wait_ns; dropped_frames += o.dropped_frames;
+            return *this;
         }
+    };
+
+    inline constexpr bool stats_enabled = ECHO_ENABLE_STATS != 0;
 
-        void draw_border(const std::string &heading = "") const
+    namespace detail {
+        // the same fields as relaxed atomics; renderers tally a frame in plain integers and add it here once
+        struct StatCounters
         {
-            std::lock_guard<std::mutex> lock(screen_lock);
-            move_cursor(x, y);
+            std::atomic<uint64_t> frames{0}, dirty_cells{0}, cells_emitted{0}, runs{0}, cursor_moves{0}, color_switches{0}, bytes{0};
+            std::atomic<uint64_t> encode_ns{0}, write_ns{0}, lock_wait_ns{0}, dropped_frames{0};
 
-            if (heading != "")
+            void add(const FrameStats &f)
             {
-                size_t heading_length = heading.length();
-                int left = ((width - 2) - heading_length) / 2;
-                int right = ((width - 2) - heading_length) - left;
-                std::cout << "+" << std::string(left, '-') << heading << std::string(right, '-') << "+";
+                constexpr auto relaxed = std::memory_order_relaxed;
+                frames.fetch_add(f.frames, relaxed); dirty_cells.fetch_add(f.dirty_cells, relaxed);
+                cells_emitted.fetch_add(f.cells_emitted, relaxed); runs.fetch_add(f.runs, relaxed);
+                cursor_moves.fetch_add(f.cursor_moves, relaxed); color_switches.fetch_add(f.color_switches, relaxed);
+                bytes.fetch_add(f.bytes, relaxed); encode_ns.fetch_add(f.encode_ns, relaxed); write_ns.fetch_add(f.write_ns, relaxed);
+                lock_wait_ns.fetch_add(f.lock_wait_ns, relaxed); dropped_frames.fetch_add(f.dropped_frames, relaxed);
             }
-            else
+            void drop(uint64_t n = 1) { dropped_frames.fetch_add(n, std::memory_order_relaxed); }
+
+            FrameStats snapshot() const
             {
-                std::cout << "+" << std::string(width - 2, '-') << '+';
+                constexpr auto relaxed = std::memory_order_relaxed;
+                FrameStats f;
+                f.frames = frames.load(relaxed); f.dirty_cells = dirty_cells.load(relaxed); f.cells_emitted = cells_emitted.load(relaxed);
+                f.runs = runs.load(relaxed); f.cursor_moves = cursor_moves.load(relaxed); f.color_switches = color_switches.load(relaxed);
+                f.bytes = bytes.load(relaxed); f.encode_ns = encode_ns.load(relaxed); f.write_ns = write_ns.load(relaxed);
+                f.lock_wait_ns = lock_wait_ns.load(relaxed); f.dropped_frames = dropped_frames.load(relaxed);
+                return f;
             }
-
-            for (int i = 1; i < height - 1; i++)
+            void reset()
             {
-                move_cursor(x, y + i);
-                std::cout << "|" << std::string(width - 2, ' ') << "|";
+                for (std::atomic<uint64_t> *c : {&frames, &dirty_cells, &cells_emitted, &runs, &cursor_moves, &color_switches, &bytes,
+                                                 &encode_ns, &write_ns, &lock_wait_ns, &dropped_frames})
+                    c->store(0, std::memory_order_relaxed);
             }
+        };
 
-            move_cursor(x, y + height - 1);
-            std::cout << "+" << std::string(width - 2, '-') << "+";
-            std::cout << std::flush;
-            
+        inline uint64_t now_ns() { return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count()); }
+
+        ECHO_STAT(inline StatCounters global_stats;)
+    }
+
+    // everything rendered by every Window and Screen so far; all zero when stats are compiled out
+    inline FrameStats stats_snapshot()
+    {
+#if ECHO_ENABLE_STATS
+        return detail::global_stats.snapshot();
+#else
+        return FrameStats();
+#endif
+    }
+    inline void reset_stats() { ECHO_STAT(detail::global_stats.reset();) }
+
+    // --------------- GLOBAL HELPERS --------------
+    inline void hide_cursor() { default_sink().write("\033[?25l"); }
+    inline void show_cursor(){ default_sink().write("\033[?25h"); }
+
+    inline void reset_cursor() {
+        std::lock_guard<std::mutex> lock(screen_lock);
+        show_cursor();
+        default_sink().write("\033[" + std::to_string(max_height) + ";1H");
+        default_sink().write(COLOR::asANSI(COLOR::RESET));
+    }
+    
+    inline void clear_screen() {
+        std::lock_guard<std::mutex> lock(screen_lock);
+        hide_cursor();
+        default_sink().write("\033[2J\033[H");
+    }
+
+    inline std::pair<int, int> get_terminal_size() { return default_sink().size(); }
+
+
+    class ThreadPool
+    { // fixed set of workers for data-parallel loops, the calling thread pitches in too
+    private:
+        std::vector<std::thread> workers;
+        std::mutex m;
+        std::condition_variable wake, done;
+        std::mutex submit; // one parallel_for at a time
+
+        const std::function<void(size_t)> *job = nullptr;
+        size_t job_count = 0;
+        std::atomic<size_t> next{0};
+        uint64_t generation = 0;
+        int active = 0;
+        bool stopping = false;
+
+        // set while this thread runs items, a parallel_for from inside one runs inline instead of waiting on itself
+        static bool &in_job()
+        {
+            thread_local bool inside = false;
+            return inside;
         }
 
-        public:
-        Window(int x, int y, int w, int h, std::string title = "")
-            : x(x), y(y), width(w), height(h), r(0), c(1) {
-            std::cout << COLOR::asANSI(COLOR::RESET);
-            max_height = (std::max)(max_height, y + h);
-            draw_border(title);
+        static void run_items(const std::function<void(size_t)> *fn, size_t count, std::atomic<size_t> &counter)
+        {
+            in_job() = true;
+            for (size_t i = counter.fetch_add(1, std::memory_order_relaxed); i < count; i = counter.fetch_add(1, std::memory_order_relaxed))
+                (*fn)(i);
+            in_job() = false;
+        }
 
-            content.resize(h - 2);
-            dirty.resize(h - 2);
-            for (int i = 0; i < h - 2; i++)
+        void worker()
+        {
+            std::unique_lock<std::mutex> lock(m);
+            uint64_t seen = 0;
+            while (true)
             {
-                content[i].resize(w - 2, Cell(' ', COLOR::RESET));
-                dirty[i].resize(w - 2, false);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                const std::function<void(size_t)> *fn = job;
+                size_t count = job_count;
+                active++;
+
+                lock.unlock();
+                if (fn)
+                    run_items(fn, count, next);
+                lock.lock();
+
+                if (--active == 0)
+                    done.notify_all();
             }
         }
 
-        ~Window() {
-            std::cout << COLOR::asANSI(COLOR::RESET);
-        }
-        void clear_inside()
+    public:
+        // threads counts the caller, so ThreadPool(1) runs everything inline
+        explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency())
         {
-            std::lock_guard<std::mutex> lock(screen_lock);
-            std::string row_content(width - 2, ' ');
+            for (unsigned i = 1; i < threads; i++)
+                workers.emplace_back([this] { worker(); });
+        }
 
-            for (int i = 1; i < height - 1; i++)
+        ~ThreadPool()
+        {
             {
-                move_cursor(x + 1, y + i);
-                std::cout << row_content;
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
             }
-            std::cout << std::flush;            
+            wake.notify_all();
+            for (std::thread &t : workers)
+                t.join();
         }
 
-        void clean_buffer() {
-            std::string row_content(width - 2, ' ');
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
 
-            for (int i = 1; i < height - 1; i++)
+        size_t size() const { return workers.size() + 1; }
+
+        // calls fn(0) .. fn(count - 1) across the pool and returns once all are done; fn must not throw
+        void parallel_for(size_t count, const std::function<void(size_t)> &fn)
+        {
+            if (in_job())
+            {
+                for (size_t i = 0; i < count; i++)
+                    fn(i);
+                return;
+            }
+            std::lock_guard<std::mutex> serial(submit);
+            if (count == 0)
+                return;
+            if (workers.empty() || count == 1)
             {
-                move_string_to_cell(i - 1, row_content, 0, COLOR::RESET);
+                std::atomic<size_t> counter{0};
+                run_items(&fn, count, counter);
+                return;
             }
+
+            {
+                std::lock_guard<std::mutex> lock(m);
+                job = &fn;
+                job_count = count;
+                next.store(0, std::memory_order_relaxed);
+                generation++;
+            }
+            wake.notify_all();
+            run_items(&fn, count, next);
+
+            std::unique_lock<std::mutex> lock(m);
+            done.wait(lock, [&] { return active == 0; });
+            job = nullptr;
+            job_count = 0;
         }
+    };
 
-        // ----------------- PUBLIC PRINT FUNCTIONS -----------------
-        void print_msg(const std::string_view &msg, const COLOR& color = COLOR(COLOR::RESET))
+    // shared by the rasteriser and anything else that splits a frame across cores
+    inline ThreadPool& default_pool()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    namespace detail {
+        // UTF-8 bytes for one code point, returns how many of `out` were used
+        inline int utf8_encode(char32_t cp, char (&out)[4])
         {
-            if (msg.length() > static_cast<size_t>(width - 2))
-                throw std::out_of_range("\nERROR: Message length exceeds window width in print_msg");
-            move_string_to_cell(r, msg.data(), 0, color);
-            (++r) %= content.size();
-            c = 1;
+            if (cp < 0x80)    { out[0] = char(cp); return 1; }
+            if (cp < 0x800)   { out[0] = char(0xC0 | cp >> 6); out[1] = char(0x80 | (cp & 0x3F)); return 2; }
+            if (cp < 0x10000) { out[0] = char(0xE0 | cp >> 12); out[1] = char(0x80 | (cp >> 6 & 0x3F)); out[2] = char(0x80 | (cp & 0x3F)); return 3; }
+            out[0] = char(0xF0 | cp >> 18); out[1] = char(0x80 | (cp >> 12 & 0x3F)); out[2] = char(0x80 | (cp >> 6 & 0x3F)); out[3] = char(0x80 | (cp & 0x3F));
+            return 4;
         }
 
-        void print_msgln(const std::string &msg, const COLOR& color = COLOR(COLOR::RESET))
+        inline int utf8_length(char32_t cp) { return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4; }
+
+        // the code point starting at s[at], U+FFFD for a malformed byte; returns how many bytes it took
+        inline size_t utf8_decode(std::string_view s, size_t at, char32_t &cp)
         {
-            if (msg.length() > static_cast<size_t>(width - 2))
+            unsigned char lead = static_cast<unsigned char>(s[at]);
+            size_t len = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xe ? 3 : (lead >> 3) == 0x1e ? 4 : 0;
+            if (len == 0 || at + len > s.size())
             {
-                print_msg(trim_string(msg, width - 2), color);
+                cp = 0xFFFD;
+                return 1;
             }
-            else
+            cp = len == 1 ? lead : lead & (0x7f >> len);
+            for (size_t k = 1; k < len; k++)
             {
-                int append_chars = (width - 2) - msg.length();
-                std::string full_msg = msg + std::string(append_chars > 0 ? append_chars : 0, ' ');
-                print_msg(full_msg, color);
+                unsigned char next = static_cast<unsigned char>(s[at + k]);
+                if ((next & 0xc0) != 0x80)
+                {
+                    cp = 0xFFFD;
+                    return k;
+                }
+                cp = cp << 6 | (next & 0x3f);
             }
+            return len;
         }
 
-        void print_line(char ch = '-', const COLOR& color = COLOR(COLOR::RESET))
-        {
-            std::string line(width - 2, ch);
-            print_msg(line, color);
-        }
+        struct CodeRange { char32_t first, last; };
+
+        // combining marks, joiners, variation selectors and emoji modifiers: drawn on top of the glyph before them
+        inline constexpr CodeRange zero_width[] = {
+            {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2}, {0x05C4, 0x05C5},
+            {0x05C7, 0x05C7}, {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+            {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711}, {0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x07EB, 0x07F3},
+            {0x0816, 0x082D}, {0x0900, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D},
+            {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981}, {0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD},
+            {0x0A01, 0x0A02}, {0x0A3C, 0x0A51}, {0x0A70, 0x0A71}, {0x0A81, 0x0A82}, {0x0ABC, 0x0ABC}, {0x0AC1, 0x0AC8},
+            {0x0ACD, 0x0ACD}, {0x0B01, 0x0B01}, {0x0B3C, 0x0B3C}, {0x0B3F, 0x0B3F}, {0x0B41, 0x0B44}, {0x0B4D, 0x0B4D},
+            {0x0BC0, 0x0BC0}, {0x0BCD, 0x0BCD}, {0x0C3E, 0x0C40}, {0x0C46, 0x0C56}, {0x0CBC, 0x0CBC}, {0x0CCC, 0x0CCD},
+            {0x0D41, 0x0D44}, {0x0D4D, 0x0D4D}, {0x0DCA, 0x0DCA}, {0x0DD2, 0x0DD6}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A},
+            {0x0E47, 0x0E4E}, {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECD}, {0x0F18, 0x0F19}, {0x0F35, 0x0F39},
+            {0x0F71, 0x0F7E}, {0x0F80, 0x0F84}, {0x102D, 0x1030}, {0x1032, 0x1037}, {0x1039, 0x103A}, {0x1160, 0x11FF},
+            {0x17B4, 0x17B5}, {0x17B7, 0x17BD}, {0x17C6, 0x17D3}, {0x180B, 0x180F}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF},
+            {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0x302A, 0x302D}, {0x3099, 0x309A},
+            {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0x1F3FB, 0x1F3FF}, {0xE0000, 0xE0FFF},
+        };
 
-        void print(int row, int col, const std::string &msg, const COLOR& color = COLOR(COLOR::RESET))
+        // East Asian wide and fullwidth, plus emoji with emoji presentation: two columns
+        inline constexpr CodeRange double_width[] = {
+            {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0}, {0x23F3, 0x23F3},
+            {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+            {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA},
+            {0x26F2, 0x26F3}, {0x26F5, 0x26F5}, {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+            {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+            {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+            {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF}, {0xA960, 0xA97F}, {0xAC00, 0xD7A3},
+            {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4},
+            {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E},
+            {0x1F191, 0x1F19A}, {0x1F200, 0x1F251}, {0x1F300, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C},
+            {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4},
+            {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E},
+            {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F},
+            {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6D7}, {0x1F6DC, 0x1F6DF},
+            {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7EB}, {0x1F7F0, 0x1F7F0}, {0x1F90C, 0x1F93A},
+            {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+        };
+
+        template <size_t N>
+        inline bool in_ranges(const CodeRange (&ranges)[N], char32_t cp)
         {
-            move_string_to_cell(row, msg, col, color);
+            const CodeRange *hit = std::upper_bound(ranges, ranges + N, cp, [](char32_t v, const CodeRange &r) { return v < r.first; });
+            return hit != ranges && cp <= hit[-1].last;
         }
 
-        void render(bool clear_first=false)
+        // terminal columns one code point takes
+        inline int char_width(char32_t cp)
         {
-            if (clear_first) clear_inside(); // use it with visalizer
+            if (cp < 0x300)
+                return 1;
+            if (in_ranges(zero_width, cp))
+                return 0;
+            return cp >= 0x1100 && in_ranges(double_width, cp) ? 2 : 1;
+        }
 
-            std::lock_guard<std::mutex> lock(screen_lock);
+        inline bool regional_indicator(char32_t cp) { return cp >= 0x1F1E6 && cp <= 0x1F1FF; }
 
-            size_t total_rows = content.size();
-            size_t total_cols = content[0].size();
+        // one user-visible character: a code point plus whatever combines with it (marks, ZWJ sequences, flag pairs)
+        struct Cluster
+        {
+            size_t end;      // one past its last byte
+            char32_t first;  // its first code point
+            int width;       // columns, 1 or 2
+            bool single;     // just `first`, no need to intern
+        };
 
-    
-            std::stringstream ss;
-            COLOR curr_color(COLOR::RESET); // temp setting
+        inline Cluster next_cluster(std::string_view s, size_t at)
+        {
+            unsigned char lead = static_cast<unsigned char>(s[at]);
+            if (lead < 0x80 && (at + 1 == s.size() || static_cast<unsigned char>(s[at + 1]) < 0x80))
+                return {at + 1, lead, 1, true};
 
-            for (size_t i = 0; i < total_rows; i++)
+            Cluster c{};
+            size_t pos = at + utf8_decode(s, at, c.first);
+            c.width = (std::max)(char_width(c.first), 1);
+            c.single = true;
+            char32_t prev = c.first;
+            while (pos < s.size())
             {
-                size_t j = 0;
-                while (j < total_cols)
-                {
-                    while (j < total_cols && !dirty[i][j])
-                        j++;
-                    if (j == total_cols)
-                        break;
-                    move_cursor(x + 1 + j, y + 1 + i);
-                    
-                    curr_color = content[i][j].color;
-                    ss << curr_color.asANSI() << content[i][j].ch;
-                    dirty[i][j] = false;
-                    j++;
-
-                    while (j < total_cols) { 
-                        if (curr_color == content[i][j].color) {
-                            ss << content[i][j].ch;
-                            dirty[i][j] = false;
-                        } else {
-                            ss << content[i][j].color.asANSI() << content[i][j].ch;
-                            curr_color = content[i][j].color;
-                            dirty[i][j] = false;
-                        }
-                        j++;
-                    }
-                    // Output the accumulated string with color changes
-                    std::cout << ss.str();
-                    ss.str("");
-                    ss.clear();
-                }
+                char32_t cp;
+                size_t len = utf8_decode(s, pos, cp);
+                bool joins = char_width(cp) == 0 || prev == 0x200D ||
+                             (regional_indicator(prev) && regional_indicator(cp) && pos == at + 4);
+                if (!joins)
+                    break;
+                if (cp == 0xFE0F || regional_indicator(cp))
+                    c.width = 2; // emoji presentation, or a flag
+                pos += len;
+                prev = cp;
+                c.single = false;
             }
-
-            std::cout << std::flush;
-            
+            c.end = pos;
+            return c;
         }
 
-        int get_h() const { return height - 2; }
-        int get_w() const { return width - 2; }
-        int get_x() const { return x; }
-        int get_y() const { return y; }
-        int get_rows() const { return content.size(); }
-        int get_cols() const { return content[0].size(); }
-    };
+        // cells refer to an interned cluster as glyph_tag | index
+        inline constexpr char32_t glyph_tag = 0x80000000;
+
+        // grapheme clusters that need more than one code point, interned once for the whole process so cells can move
+        // between windows, screens and recordings. entries are never removed or moved, so readers take no lock
+        class GlyphTable
+        {
+        public:
+            struct Entry { std::string bytes; int width = 1; };
+
+        private:
+            struct BytesHash
+            { // lets a string_view find a string key without building one
+                using is_transparent = void;
+                size_t operator()(std::string_view bytes) const { return std::hash<std::string_view>{}(bytes); }
+            };
+
+            static constexpr size_t chunk_size = 1024;
+            std::array<std::atomic<Entry *>, 4096> chunks{};
+            std::shared_mutex lock;
+            std::unordered_map<std::string, char32_t, BytesHash, std::equal_to<>> ids;
+            size_t count = 0;
+
+        public:
+            GlyphTable() = default;
+            GlyphTable(const GlyphTable &) = delete;
+            GlyphTable &operator=(const GlyphTable &) = delete;
+            ~GlyphTable()
+            {
+                for (std::atomic<Entry *> &chunk : chunks)
+                    delete[] chunk.load();
+            }
+
+            // every frame looks the same clusters up again: hits share the lock and allocate nothing
+            char32_t intern(std::string_view utf8, int width)
+            {
+                {
+                    std::shared_lock<std::shared_mutex> guard(lock);
+                    auto found = ids.find(utf8);
+                    if (found != ids.end())
+                        return found->second;
+                }
+                std::lock_guard<std::shared_mutex> guard(lock);
+                auto found = ids.find(utf8); // another thread may have added it in between
+                if (found != ids.end())
+                    return found->second;
+                if (count == chunks.size() * chunk_size)
+                    throw std::out_of_range("\nERROR: Too many distinct glyphs");
+
+                std::atomic<Entry *> &chunk = chunks[count / chunk_size];
+                if (!chunk.load(std::memory_order_relaxed))
+                    chunk.store(new Entry[chunk_size], std::memory_order_release);
+                Entry &entry = chunk.load(std::memory_order_relaxed)[count % chunk_size];
+                entry.bytes = utf8;
+                entry.width = width;
+
+                char32_t id = glyph_tag | static_cast<char32_t>(count++);
+                ids.emplace(entry.bytes, id);
+                return id;
+            }
+
+            const Entry &at(char32_t id) const
+            {
+                size_t index = id & ~glyph_tag;
+                return chunks[index / chunk_size].load(std::memory_order_acquire)[index % chunk_size];
+            }
+        };
+
+        inline GlyphTable &glyphs()
+        {
+            static GlyphTable table;
+            return table;
+        }
+
+        // what a cell's character looks like on the wire: its code point in UTF-8, or an interned cluster's bytes
+        inline std::string_view glyph_bytes(char32_t ch, char (&buf)[4])
+        {
+            if (ch & glyph_tag)
+                return glyphs().at(ch).bytes;
+            return std::string_view(buf, utf8_encode(ch, buf));
+        }
+
+        inline int glyph_width(char32_t ch)
+        {
+            if (ch < 0x1100 || (ch >= 0x2500 && ch < 0x25FD) || (ch >= 0x2800 && ch < 0x2900)) // box drawing, blocks, braille
+                return 1;
+            if (ch & glyph_tag)
+                return glyphs().at(ch).width;
+            return char_width(ch) == 2 ? 2 : 1;
+        }
+
+        // what a cell stores for a cluster: its code point when it stands alone, otherwise its interned id
+        inline char32_t cluster_char(std::string_view s, size_t at, const Cluster &c)
+        {
+            if (!c.single)
+                return glyphs().intern(s.substr(at, c.end - at), c.width);
+            if (c.first >= 0x300 && char_width(c.first) == 0) // a stray combining mark gets a space to sit on
+            {
+                char spaced[5] = {' '};
+                std::memcpy(spaced + 1, s.data() + at, c.end - at); // a single code point, at most 4 bytes
+                return glyphs().intern(std::string_view(spaced, 1 + c.end - at), 1);
+            }
+            return c.first;
+        }
+
+        // bytes in the longest run of whole clusters from the start of s that fits in `columns`
+        inline size_t fit_columns(std::string_view s, size_t columns)
+        {
+            size_t at = 0, used = 0;
+            while (at < s.size())
+            {
+                Cluster c = next_cluster(s, at);
+                if (used + c.width > columns)
+                    break;
+                used += c.width;
+                at = c.end;
+            }
+            return at;
+        }
+
+        // columns the text takes on screen
+        inline size_t text_width(std::string_view s)
+        {
+            size_t used = 0;
+            for (size_t at = 0; at < s.size();)
+            {
+                Cluster c = next_cluster(s, at);
+                used += c.width;
+                at = c.end;
+            }
+            return used;
+        }
+    }
+
+    struct Cell
+    { // so that each cell can have its own character and color
+        static constexpr uint8_t Wide = 1;         // left half of a double-width glyph
+        static constexpr uint8_t Continuation = 2; // right half, never drawn on its own; its ch is 0
+
+        char32_t ch;      // a Unicode code point, plain chars are stored as-is; multi-code-point clusters are interned
+        COLOR color;
+        uint8_t flags = 0; // keeps the cell 8 bytes with no padding so rows can be memcmp'd
+
+        Cell(char ch = ' ', const COLOR& color = COLOR(COLOR::RESET)) : ch(static_cast<unsigned char>(ch)), color(color) {}
+        Cell(char32_t ch, const COLOR& color = COLOR(COLOR::RESET))
+            : ch(ch), color(color), flags(ch >= 0x1100 && detail::glyph_width(ch) == 2 ? Wide : 0) {}
+
+        static Cell continuation(const COLOR &color)
+        {
+            Cell cell(char32_t(0), color);
+            cell.flags = Continuation;
+            return cell;
+        }
+
+        bool operator==(const Cell &other) const { return ch == other.ch && color == other.color; }
+        bool operator!=(const Cell &other) const { return ch != other.ch || color != other.color; }
+
+        // blanks carry no ink, so their color is irrelevant on screen
+        bool looks_like(const Cell &other) const { return ch == other.ch && (ch == ' ' || color == other.color); }
+
+        friend std::ostream &operator<<(std::ostream &out, const Cell &cell)
+        {
+            if (cell.flags & Continuation)
+                return out;
+            char bytes[4];
+            std::string_view glyph = detail::glyph_bytes(cell.ch, bytes);
+            out << cell.color.asANSI();
+            out.write(glyph.data(), glyph.size());
+            return out;
+        }
+    };
+
+    namespace detail {
+        // a Recorder's copy of the terminal as renderers last left it, written in place while a frame is encoded.
+        // a bit per cell marks what changed since the recorder's thread last took it, so any number of frames cost
+        // one copy of each changed cell and nothing is allocated. coordinates are 1-based, off-terminal ones are dropped
+        struct DamageTap
+        {
+            struct Scroll { int top, bottom, n; };
+
+            std::vector<Cell> cells;
+            std::vector<uint64_t> marks; // `words` per row
+            std::vector<Scroll> scrolls; // since the last take, each applied to `cells` and `marks` already
+            int cols = 0, rows = 0, words = 0;
+
+            void resize(int width, int height)
+            {
+                cols = width;
+                rows = height;
+                words = (width + 63) / 64;
+                cells.assign(size_t(cols) * rows, Cell());
+                marks.assign(size_t(words) * rows, 0);
+            }
+
+            void add(int x, int y, const Cell &cell)
+            {
+                unsigned cx = static_cast<unsigned>(x - 1), cy = static_cast<unsigned>(y - 1);
+                if (cx >= static_cast<unsigned>(cols) || cy >= static_cast<unsigned>(rows))
+                    return;
+                cells[cy * size_t(cols) + cx] = cell;
+                marks[cy * size_t(words) + cx / 64] |= uint64_t(1) << (cx % 64);
+            }
+
+            // rows [top, bottom] move up by n, what comes in at the bottom is blank, as on the terminal
+            void scroll(int top, int bottom, int n)
+            {
+                scrolls.push_back({top, bottom, n});
+                top = (std::max)(top, 1);
+                bottom = (std::min)(bottom, rows);
+                n = (std::min)(n, bottom - top + 1);
+                if (n <= 0)
+                    return;
+                int keep = bottom - top + 1 - n;
+                Cell *region = &cells[(top - 1) * size_t(cols)];
+                std::move(region + n * size_t(cols), region + (bottom - top + 1) * size_t(cols), region);
+                std::fill(region + keep * size_t(cols), region + (bottom - top + 1) * size_t(cols), Cell());
+                uint64_t *bits = &marks[(top - 1) * size_t(words)];
+                std::move(bits + n * size_t(words), bits + (bottom - top + 1) * size_t(words), bits);
+                std::fill(bits + keep * size_t(words), bits + (bottom - top + 1) * size_t(words), 0);
+            }
+        };
+    }
+
+    class FrameEncoder
+    { // builds a whole frame of escapes in one reusable buffer and hands it to the terminal in one write
+    private:
+        std::string buffer;
+        Sink *sink = &default_sink();
+        uint32_t pen = 0; // color_code of the current foreground in the mode it was set in
+        bool pen_known = false;
+
+        // where the terminal cursor really is (1-based), so moves can be relative or skipped altogether
+        int cur_x = 0, cur_y = 0;
+        bool cursor_known = false;
+        int right_edge = INT_MAX; // last terminal column, writing there leaves the cursor in the pending-wrap state
+
+        // other encoders' buffers that go out in the middle of this one, at byte `at`, without being copied in
+        struct Splice { size_t at; const std::string *text; };
+        std::vector<Splice> splices;
+        size_t spliced = 0;
+        std::vector<std::string_view> parts;
+
+        void append(char ch) { buffer.push_back(ch); }
+        void append(std::string_view text) { buffer.append(text.data(), text.size()); }
+
+        static int digits(unsigned n) { return n < 10 ? 1 : n < 100 ? 2 : n < 1000 ? 3 : n < 10000 ? 4 : 10; }
+
+        // CSI n <final>, where n = 1 can be left out
+        void csi(unsigned n, char final)
+        {
+            append("\033[");
+            if (n != 1)
+                put_number(n);
+            append(final);
+        }
+        static int csi_cost(unsigned n) { return n == 1 ? 3 : 3 + digits(n); }
+
+        static int cup_cost(int cx, int cy)
+        {
+            if (cx == 1)
+                return cy == 1 ? 3 : 3 + digits(cy);
+            return 4 + digits(cy) + digits(cx);
+        }
+
+        int horizontal_cost(int from, int to) const
+        {
+            if (to == from) return 0;
+            if (to > from) return csi_cost(to - from);
+            int n = from - to;
+            int cost = (std::min)(n, csi_cost(n)); // backspaces or CUB
+            return (std::min)(cost, 1 + horizontal_cost(1, to)); // CR then forward
+        }
+
+        static int vertical_cost(int from, int to)
+        {
+            return to == from ? 0 : csi_cost(to > from ? to - from : from - to);
+        }
+
+        void emit_horizontal(int from, int to)
+        {
+            if (to == from) return;
+            if (to > from) { csi(to - from, 'C'); return; }
+            int n = from - to;
+            int back = (std::min)(n, csi_cost(n));
+            if (1 + horizontal_cost(1, to) < back)
+            {
+                append('\r');
+                emit_horizontal(1, to);
+            }
+            else if (n <= csi_cost(n))
+                buffer.append(n, '\b');
+            else
+                csi(n, 'D');
+        }
+
+        void emit_vertical(int from, int to)
+        {
+            if (to > from) csi(to - from, 'B');
+            else if (to < from) csi(from - to, 'A');
+        }
+
+    public:
+        FrameEncoder() { buffer.reserve(4096); }
+
+        // forget the terminal state, something else may have written to it since the last frame
+        void begin_frame() { pen_known = false; cursor_known = false; }
+
+        void set_right_edge(int column) { right_edge = column > 0 ? column : INT_MAX; }
+
+        // raw text, the cursor position is unknown afterwards
+        void put(char ch) { append(ch); cursor_known = false; }
+        void put(std::string_view text) { append(text); cursor_known = false; }
+        void put(char ch, size_t count) { buffer.append(count, ch); cursor_known = false; }
+
+        // a single-column glyph at the cursor, which then advances
+        void glyph(char32_t ch)
+        {
+            if (ch < 0x80)
+                append(char(ch));
+            else
+            {
+                char bytes[4];
+                buffer.append(bytes, detail::utf8_encode(ch, bytes));
+            }
+            if (cursor_known && ++cur_x > right_edge)
+                cursor_known = false;
+        }
+
+        // a cell's glyph, interned clusters are copied out of the glyph table as-is; wide ones advance two columns
+        void glyph(const Cell &cell)
+        {
+            if (cell.ch < 0x80)
+                append(char(cell.ch));
+            else
+            {
+                char bytes[4];
+                append(detail::glyph_bytes(cell.ch, bytes));
+            }
+            if (cursor_known && (cur_x += (cell.flags & Cell::Wide) ? 2 : 1) > right_edge)
+                cursor_known = false;
+        }
+
+        void put_number(unsigned n)
+        {
+            if (n < 256)
+            {
+                const detail::Decimal &d = detail::decimals[n];
+                buffer.append(d.text, d.len);
+                return;
+            }
+            char digits[10];
+            char *p = digits + sizeof(digits);
+            do { *--p = char('0' + n % 10); n /= 10; } while (n);
+            buffer.append(p, digits + sizeof(digits) - p);
+        }
+
+        // scroll terminal rows top..bottom (1-based) up by n through a DECSTBM region, then drop the region again.
+        // leaving it set would make every LF the cursor planner emits at the bottom margin scroll instead of move
+        void scroll_up(int top, int bottom, int n)
+        {
+            append("\033[");
+            put_number(top);
+            append(';');
+            put_number(bottom);
+            append('r');
+            csi(n, 'S');
+            append("\033[r");
+            cursor_known = false; // setting the margins homes the cursor
+            if (tap)
+                tap->scroll(top, bottom, n);
+        }
+
+        detail::DamageTap *tap = nullptr; // set while the frame is being recorded
+
+        ECHO_STAT(FrameStats tally;) // this frame so far, folded into the counters by whoever renders
+
+        bool at(int cx, int cy) const { return cursor_known && cur_x == cx && cur_y == cy; }
+        bool cursor_on_row(int cy) const { return cursor_known && cur_y == cy; }
+        int cursor_x() const { return cur_x; }
+        template <ColorMode M = ColorMode::TrueColor>
+        bool pen_is(const COLOR &color) const
+        {
+            if constexpr (M == ColorMode::Monochrome)
+                return true;
+            else
+                return pen_known && pen == detail::color_code<M>(color);
+        }
+
+        // bytes the cheapest way of getting the cursor to (cx, cy) would take
+        int move_cost(int cx, int cy) const
+        {
+            int cost = cup_cost(cx, cy);
+            if (!cursor_known)
+                return cost;
+            cost = (std::min)(cost, vertical_cost(cur_y, cy) + horizontal_cost(cur_x, cx));
+            if (cy > cur_y) // CR then line feeds, works whether or not the tty maps NL to CR-NL
+                cost = (std::min)(cost, 1 + (cy - cur_y) + horizontal_cost(1, cx));
+            return cost;
+        }
+
+        // 1-based terminal column and row
+        void move_to(int cx, int cy)
+        {
+            if (at(cx, cy))
+                return;
+            ECHO_STAT(tally.cursor_moves++;)
+
+            if (cursor_known)
+            {
+                int absolute = cup_cost(cx, cy);
+                int relative = vertical_cost(cur_y, cy) + horizontal_cost(cur_x, cx);
+                int newline = cy > cur_y ? 1 + (cy - cur_y) + horizontal_cost(1, cx) : INT_MAX;
+
+                if (newline < relative && newline < absolute)
+                {
+                    append('\r');
+                    buffer.append(cy - cur_y, '\n');
+                    emit_horizontal(1, cx);
+                    cur_x = cx; cur_y = cy;
+                    return;
+                }
+                if (relative < absolute)
+                {
+                    emit_vertical(cur_y, cy);
+                    emit_horizontal(cur_x, cx);
+                    cur_x = cx; cur_y = cy;
+                    return;
+                }
+            }
+
+            append("\033[");
+            if (cx == 1)
+            {
+                if (cy != 1)
+                    put_number(cy);
+            }
+            else
+            {
+                put_number(cy);
+                append(';');
+                put_number(cx);
+            }
+            append('H');
+            cur_x = cx; cur_y = cy;
+            cursor_known = true;
+        }
+
+        // one instantiation per mode, so the per-cell path never branches on it
+        template <ColorMode M = ColorMode::TrueColor>
+        void set_color(const COLOR &color)
+        {
+            if constexpr (M == ColorMode::Monochrome)
+                return;
+            else
+            {
+                uint32_t code = detail::color_code<M>(color);
+                if (pen_known && pen == code)
+                    return;
+                pen = code;
+                pen_known = true;
+                ECHO_STAT(tally.color_switches++;)
+
+                if constexpr (M == ColorMode::TrueColor)
+                {
+                    append("\033[38;2;");
+                    put_number(color.r);
+                    append(';');
+                    put_number(color.g);
+                    append(';');
+                    put_number(color.b);
+                    append('m');
+                }
+                else if constexpr (M == ColorMode::Palette256)
+                {
+                    append("\033[38;5;");
+                    put_number(code);
+                    append('m');
+                }
+                else
+                {
+                    append("\033[");
+                    append(code < 8 ? '3' : '9');
+                    append(char('0' + (code & 7)));
+                    append('m');
+                }
+            }
+        }
+
+        // a band of the frame encoded separately: starts with no known cursor or pen, or with this encoder's when `inherit`
+        void begin_band(FrameEncoder &band, bool inherit) const
+        {
+            band.buffer.clear();
+            band.right_edge = right_edge;
+            band.pen = pen;
+            band.pen_known = inherit && pen_known;
+            band.cur_x = cur_x;
+            band.cur_y = cur_y;
+            band.cursor_known = inherit && cursor_known;
+        }
+
+        // continue after a band: its bytes go out here when flushed, and the terminal is left as the band left it.
+        // the band's buffer has to stay untouched until then
+        void splice(const FrameEncoder &band)
+        {
+            if (band.buffer.empty())
+                return;
+            splices.push_back({buffer.size(), &band.buffer});
+            spliced += band.buffer.size();
+            pen = band.pen;
+            pen_known = band.pen_known;
+            cur_x = band.cur_x;
+            cur_y = band.cur_y;
+            cursor_known = band.cursor_known;
+        }
+
+        bool empty() const { return size() == 0; }
+        size_t size() const { return buffer.size() + spliced; }
+        const char *data() const { return buffer.data(); } // this encoder's own bytes, spliced bands not included
+        void clear()
+        {
+            buffer.clear();
+            splices.clear();
+            spliced = 0;
+        }
+
+        void set_sink(Sink &target) { sink = &target; }
+        Sink &get_sink() const { return *sink; }
+
+        // caller holds screen_lock
+        void flush()
+        {
+            if (empty())
+                return;
+            ECHO_STAT(uint64_t start = detail::now_ns(); size_t total = size();)
+            if (splices.empty())
+                sink->write(buffer);
+            else
+            {
+                // one gathered write: our own bytes with the bands' buffers in between
+                parts.clear();
+                size_t from = 0;
+                for (const Splice &splice : splices)
+                {
+                    parts.emplace_back(buffer.data() + from, splice.at - from);
+                    parts.emplace_back(*splice.text);
+                    from = splice.at;
+                }
+                parts.emplace_back(buffer.data() + from, buffer.size() - from);
+                sink->write(parts.data(), parts.size());
+            }
+            ECHO_STAT(tally.write_ns += detail::now_ns() - start; tally.bytes += total;)
+            clear();
+        }
+    };
+
+    namespace detail {
+        // back/front cell buffers plus damage tracking, shared by Window and Screen
+        struct DamageGrid
+        {
+            // flat framebuffer: row i starts at back[i * stride], stride is padded to a whole cache line
+            int rows = 0, cols = 0;
+            size_t stride = 0;
+            aligned_vector<Cell> back;
+            aligned_vector<Cell> front; // what the terminal is currently showing, same layout as back
+
+            // one bit per cell, packed 64 cells to a word, plus a per-row count so clean rows are skipped outright
+            // a set bit only means the cell was written since the last encode, encode() still diffs it against front
+            size_t words_per_row = 0;
+            std::vector<uint64_t> dirty;
+            std::vector<uint32_t> row_dirty;
+
+            void resize(int new_rows, int new_cols, const Cell &fill = Cell(' ', COLOR::RESET))
+            {
+                rows = (std::max)(new_rows, 0);
+                cols = (std::max)(new_cols, 0);
+                constexpr size_t cells_per_line = (std::max)(size_t(1), cache_line / sizeof(Cell));
+                stride = (cols + cells_per_line - 1) / cells_per_line * cells_per_line;
+                words_per_row = (cols + 63) / 64;
+
+                back.assign(rows * stride, fill);
+                front = back;
+                dirty.assign(rows * words_per_row, 0);
+                row_dirty.assign(rows, 0);
+            }
+
+            Cell* row(int r) { return &back[r * stride]; }
+            const Cell* row(int r) const { return &back[r * stride]; }
+            Cell& at(int r, int c) { return back[r * stride + c]; }
+            const Cell& at(int r, int c) const { return back[r * stride + c]; }
+
+            void mark(int r, int c)
+            {
+                uint64_t &word = dirty[r * words_per_row + (c >> 6)];
+                uint64_t bit = uint64_t(1) << (c & 63);
+                if (!(word & bit))
+                {
+                    word |= bit;
+                    row_dirty[r]++;
+                }
+            }
+
+            void set(int r, int c, const Cell &cell)
+            {
+                Cell &target = back[r * stride + c];
+                if (target == cell)
+                    return;
+                if ((target.flags | cell.flags) == 0)
+                {
+                    target = cell;
+                    mark(r, c);
+                    return;
+                }
+                set_paired(r, c, cell);
+            }
+
+            void put(int r, int c, const Cell &cell)
+            {
+                Cell &target = back[r * stride + c];
+                if (target != cell)
+                {
+                    target = cell;
+                    mark(r, c);
+                }
+            }
+
+            // a double-width glyph and its continuation are only ever written, or broken up, together
+            void set_paired(int r, int c, const Cell &cell)
+            {
+                Cell *cells = row(r);
+                bool wide = (cell.flags & Cell::Wide) && c + 1 < cols; // no room for the right half, draw nothing
+                int end = c + (wide ? 2 : 1);
+                if ((cells[c].flags & Cell::Continuation) && c > 0)
+                    put(r, c - 1, Cell(' ', cells[c - 1].color));
+                if (end < cols && (cells[end].flags & Cell::Continuation))
+                    put(r, end, Cell(' ', cells[end].color));
+                put(r, c, (cell.flags & Cell::Wide) && !wide ? Cell(' ', cell.color) : cell);
+                if (wide)
+                    put(r, c + 1, Cell::continuation(cell.color));
+            }
+
+            // a raw copy into [c0, c1) may have split a pair at either end, blank whichever half was left behind
+            void repair_pairs(int r, int c0, int c1)
+            {
+                const Cell *cells = row(r);
+                auto orphan = [&](int k) { put(r, k, Cell(' ', cells[k].color)); };
+                if ((cells[c0].flags & Cell::Continuation) && (c0 == 0 || !(cells[c0 - 1].flags & Cell::Wide)))
+                    orphan(c0);
+                if (c0 > 0 && (cells[c0 - 1].flags & Cell::Wide) && !(cells[c0].flags & Cell::Continuation))
+                    orphan(c0 - 1);
+                int last = c1 - 1;
+                if ((cells[last].flags & Cell::Wide) && (c1 == cols || !(cells[c1].flags & Cell::Continuation)))
+                    orphan(last);
+                if (c1 < cols && (cells[c1].flags & Cell::Continuation) && !(cells[last].flags & Cell::Wide))
+                    orphan(c1);
+            }
+
+            // copy n source cells into row r from column c, marking only the ones that actually changed
+            void blit_row(int r, int c, const Cell *src, int n)
+            {
+                Cell *dst = &back[r * stride + c];
+                if (std::memcmp(dst, src, n * sizeof(Cell)) == 0) // the common case for a still frame
+                    return;
+                for (int k = 0; k < n; k++)
+                    if (dst[k] != src[k])
+                    {
+                        dst[k] = src[k];
+                        mark(r, c + k);
+                    }
+                if (n > 0)
+                    repair_pairs(r, c, c + n);
+            }
+            void blit_row(int r, int c, const char *chars, const COLOR *colors, int n)
+            {
+                Cell *dst = &back[r * stride + c];
+                for (int k = 0; k < n; k++)
+                {
+                    const Cell cell(chars[k], colors[k]);
+                    if (dst[k] != cell)
+                    {
+                        dst[k] = cell;
+                        mark(r, c + k);
+                    }
+                }
+                if (n > 0)
+                    repair_pairs(r, c, c + n);
+            }
+
+            // the terminal scrolled these rows up by n: move back, front and the dirty bits along, blank the bottom
+            void scroll_up(int n, const Cell &blank = Cell(' ', COLOR::RESET))
+            {
+                n = std::clamp(n, 0, rows);
+                size_t kept = (rows - n) * stride;
+                std::move(back.begin() + n * stride, back.end(), back.begin());
+                std::move(front.begin() + n * stride, front.end(), front.begin());
+                std::fill(back.begin() + kept, back.end(), blank);
+                std::fill(front.begin() + kept, front.end(), blank);
+
+                std::move(dirty.begin() + n * words_per_row, dirty.end(), dirty.begin());
+                std::fill(dirty.begin() + (rows - n) * words_per_row, dirty.end(), 0);
+                std::move(row_dirty.begin() + n, row_dirty.end(), row_dirty.begin());
+                std::fill(row_dirty.begin() + (rows - n), row_dirty.end(), 0);
+            }
+
+            // the terminal now shows `shown` at (r, c), resend the cell if that is not what we hold
+            void assume_front(int r, int c, const Cell &shown)
+            {
+                front[r * stride + c] = shown;
+                if (!back[r * stride + c].looks_like(shown))
+                    mark(r, c);
+            }
+
+            // on_word sees each word of dirty bits before its cells, (index, bits)
+            template <typename Fn, typename Word = std::nullptr_t>
+            void for_each_dirty(int r, Fn &&fn, Word &&on_word = nullptr)
+            {
+                uint64_t *row_bits = &dirty[r * words_per_row];
+                for (size_t w = 0; w < words_per_row; w++)
+                {
+                    uint64_t bits = row_bits[w];
+                    if constexpr (!std::is_same_v<std::decay_t<Word>, std::nullptr_t>)
+                        on_word(w, bits);
+                    while (bits)
+                    {
+                        fn(static_cast<int>(w * 64) + std::countr_zero(bits));
+                        bits &= bits - 1;
+                    }
+                    row_bits[w] = 0;
+                }
+                row_dirty[r] = 0;
+            }
+
+            // reach (cx, cy), retyping a short run of clean cells when that is cheaper than any escape
+            template <ColorMode M>
+            void skip_to(FrameEncoder &out, int cx, int cy, int origin_x, const Cell *shown) const
+            {
+                int from = out.cursor_x();
+                int gap = cx - from;
+                if (out.cursor_on_row(cy) && from >= origin_x && gap > 0 && gap <= out.move_cost(cx, cy))
+                {
+                    int budget = out.move_cost(cx, cy);
+                    bool same_ink = true;
+                    for (int k = from; k < cx && same_ink; k++)
+                    {
+                        const Cell &cell = shown[k - origin_x];
+                        budget -= detail::utf8_length(cell.ch);
+                        same_ink = budget >= 0 && !cell.flags && !(cell.ch & detail::glyph_tag) &&
+                                   (cell.ch == ' ' || out.pen_is<M>(cell.color));
+                    }
+                    if (same_ink)
+                    {
+                        for (int k = from; k < cx; k++)
+                            out.glyph(shown[k - origin_x].ch);
+                        return;
+                    }
+                }
+                out.move_to(cx, cy);
+            }
+
+            // emit every dirty cell of rows [r0, r1) that differs from the front buffer, (origin_x, origin_y) is where cell (0, 0) sits
+            template <ColorMode M>
+            void encode_as(FrameEncoder &out, int origin_x, int origin_y, int r0, int r1)
+            {
+                for (int i = r0; i < r1; i++)
+                {
+                    if (!row_dirty[i])
+                        continue;
+
+                    const Cell *cells = row(i);
+                    Cell *shown = &front[i * stride];
+
+                    // while recording, changed cells are also copied to the recorder's stage, and the row's dirty words are
+                    // or'ed into its marks a word at a time. a cell written but unchanged is marked too, the recorder drops
+                    // it against its own canvas. bands touch disjoint rows of the stage
+                    Cell *staged = nullptr;
+                    uint64_t *marks = nullptr;
+                    int lo = 0, hi = 0, shift = origin_x - 1; // stage column = j + shift, for j in [lo, hi)
+                    if (out.tap && origin_y + i >= 1 && origin_y + i <= out.tap->rows)
+                    {
+                        staged = &out.tap->cells[(origin_y + i - 1) * size_t(out.tap->cols)];
+                        marks = &out.tap->marks[(origin_y + i - 1) * size_t(out.tap->words)];
+                        lo = (std::max)(-shift, 0);
+                        hi = (std::min)(out.tap->cols - shift, cols);
+                    }
+                    auto mark_word = [&](size_t w, uint64_t bits) {
+                        int base = static_cast<int>(w * 64);
+                        if (!marks || !bits || base >= hi || base + 64 <= lo)
+                            return;
+                        if (base < lo)
+                            bits &= ~uint64_t(0) << (lo - base);
+                        if (base + 64 > hi)
+                            bits &= ~uint64_t(0) >> (base + 64 - hi);
+                        int at = base + shift; // stage column of bit 0, the bits clipped above cover anything below 0
+                        if (at < 0)
+                        {
+                            bits >>= -at;
+                            at = 0;
+                        }
+                        marks[at / 64] |= bits << (at % 64);
+                        if (at % 64 && bits >> (64 - at % 64))
+                            marks[at / 64 + 1] |= bits >> (64 - at % 64);
+                    };
+
+                    for_each_dirty(i, [&](int j) {
+                        ECHO_STAT(out.tally.dirty_cells++;)
+                        // written since last frame but ended up looking as it already does on screen
+                        if (cells[j].ch == shown[j].ch &&
+                            (cells[j].ch == ' ' || detail::color_code<M>(cells[j].color) == detail::color_code<M>(shown[j].color)))
+                            return;
+                        shown[j] = cells[j];
+                        int cx = origin_x + j, cy = origin_y + i;
+                        if (staged && j >= lo && j < hi)
+                            staged[j + shift] = cells[j];
+                        if (cells[j].flags & Cell::Continuation) // drawn along with the wide glyph to its left
+                            return;
+                        ECHO_STAT(out.tally.cells_emitted++;)
+
+                        if (!out.at(cx, cy))
+                        {
+                            ECHO_STAT(out.tally.runs++;)
+                            skip_to<M>(out, cx, cy, origin_x, shown);
+                        }
+                        out.set_color<M>(cells[j].color);
+                        out.glyph(cells[j]);
+                    }, mark_word);
+                }
+            }
+
+            void encode_rows(FrameEncoder &out, int origin_x, int origin_y, int r0, int r1, ColorMode mode)
+            {
+                switch (mode)
+                {
+                case ColorMode::TrueColor:  encode_as<ColorMode::TrueColor>(out, origin_x, origin_y, r0, r1); break;
+                case ColorMode::Palette256: encode_as<ColorMode::Palette256>(out, origin_x, origin_y, r0, r1); break;
+                case ColorMode::Palette16:  encode_as<ColorMode::Palette16>(out, origin_x, origin_y, r0, r1); break;
+                case ColorMode::Monochrome: encode_as<ColorMode::Monochrome>(out, origin_x, origin_y, r0, r1); break;
+                }
+            }
+
+            // below this many dirty cells per band, waking workers costs more than it saves
+            static constexpr size_t band_cells = 8192;
+
+            // rows are independent, so a big frame is split into bands of about equal damage, each encoded into its own
+            // buffer on the pool. a band starts with an absolute move and a full colour, the joins cost a few bytes
+            std::vector<FrameEncoder> bands;
+            std::vector<int> band_start;
+
+            // with `parallel`, big frames go to `pool`, default_pool() when that is null (and only then is it started)
+            void encode(FrameEncoder &out, int origin_x, int origin_y, ColorMode mode = ColorMode::TrueColor,
+                        bool parallel = false, ThreadPool *pool = nullptr)
+            {
+                size_t damage = 0;
+                if (parallel)
+                    for (int i = 0; i < rows; i++)
+                        damage += row_dirty[i];
+                if (damage < 2 * band_cells)
+                {
+                    encode_rows(out, origin_x, origin_y, 0, rows, mode);
+                    return;
+                }
+                ThreadPool &workers = pool ? *pool : default_pool();
+                size_t count = (std::min)({damage / band_cells, workers.size(), size_t(rows)});
+                if (count < 2)
+                {
+                    encode_rows(out, origin_x, origin_y, 0, rows, mode);
+                    return;
+                }
+
+                bands.resize(count);
+                band_start.assign(count + 1, rows);
+                band_start[0] = 0;
+                size_t seen = 0, k = 1;
+                for (int i = 0; i < rows && k < count; i++)
+                {
+                    seen += row_dirty[i];
+                    if (seen >= damage * k / count)
+                        band_start[k++] = i + 1;
+                }
+
+                workers.parallel_for(count, [&](size_t b) {
+                    out.begin_band(bands[b], b == 0);
+                    bands[b].tap = out.tap;
+                    encode_rows(bands[b], origin_x, origin_y, band_start[b], band_start[b + 1], mode);
+                });
+                for (size_t b = 0; b < count; b++)
+                {
+                    out.splice(bands[b]);
+                    ECHO_STAT(out.tally += bands[b].tally; bands[b].tally = FrameStats();)
+                    bands[b].tap = nullptr;
+                }
+            }
+        };
+    }
+
+    namespace detail {
+        // single producer, single consumer; the producer never waits on the consumer and vice versa
+        template <typename T>
+        class TripleBuffer
+        {
+        private:
+            static constexpr uint8_t fresh = 4;
+
+            T slots[3];
+            uint8_t back = 0, front = 1;       // owned by producer and consumer respectively
+            std::atomic<uint8_t> middle{2};    // slot index, plus `fresh` once the producer has published into it
+
+        public:
+            explicit TripleBuffer(const T &init) : slots{init, init, init} {}
+
+            T& write_buffer() { return slots[back]; }
+            // true when the frame it replaces was never acquired, i.e. the consumer missed it
+            bool publish()
+            {
+                uint8_t old = middle.exchange(back | fresh, std::memory_order_acq_rel);
+                back = old & 3;
+                return old & fresh;
+            }
+
+            // true when a newer frame replaced the read buffer
+            bool acquire()
+            {
+                if (!(middle.load(std::memory_order_relaxed) & fresh))
+                    return false;
+                front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+                return true;
+            }
+            const T& read_buffer() const { return slots[front]; }
+
+            // start over from `init`, only while nobody is publishing or acquiring
+            void reset(const T &init)
+            {
+                for (T &slot : slots)
+                    slot = init;
+                back = 0;
+                front = 1;
+                middle.store(2, std::memory_order_release);
+            }
+        };
+    }
+
+    // a headless terminal: parses what the library emits back into cells, so frames can be checked and measured without a tty.
+    // it understands the subset echo writes (cursor moves, SGR foregrounds, erase, DECSTBM/SU, autowrap, UTF-8)
+    class VirtualTerminal : public Sink
+    {
+    private:
+        int cols, rows;
+        std::vector<Cell> cells;
+        int cx = 0, cy = 0;            // 0-based cursor
+        bool wrap_pending = false;     // a glyph went into the last column, the next one wraps first
+        int top = 0, bottom = 0;       // scroll region, inclusive
+        COLOR pen = COLOR(COLOR::RESET);
+        uint64_t escapes = 0, glyphs = 0;
+
+        // parser state survives between writes, a frame may be split anywhere
+        enum class State : uint8_t { Ground, Escape, Csi };
+        State state = State::Ground;
+        std::string params;
+        char32_t utf8_cp = 0;
+        int utf8_left = 0;
+        char32_t last_cp = 0; // the code point printed before, for clusters that join onto it
+
+        void scroll_up(int n)
+        {
+            n = (std::min)(n, bottom - top + 1);
+            std::move(cells.begin() + (top + n) * cols, cells.begin() + (bottom + 1) * cols, cells.begin() + top * cols);
+            std::fill(cells.begin() + (bottom + 1 - n) * cols, cells.begin() + (bottom + 1) * cols, Cell(' ', pen));
+        }
+        void scroll_down(int n)
+        {
+            n = (std::min)(n, bottom - top + 1);
+            std::move_backward(cells.begin() + top * cols, cells.begin() + (bottom + 1 - n) * cols, cells.begin() + (bottom + 1) * cols);
+            std::fill(cells.begin() + top * cols, cells.begin() + (top + n) * cols, Cell(' ', pen));
+        }
+        void line_feed()
+        {
+            if (cy == bottom)
+                scroll_up(1);
+            else if (cy < rows - 1)
+                cy++;
+        }
+
+        // writing over either half of a wide glyph wipes the other one
+        void unpair(int x)
+        {
+            Cell *line = &cells[cy * cols];
+            if ((line[x].flags & Cell::Continuation) && x > 0)
+                line[x - 1] = Cell(' ', line[x - 1].color);
+            if ((line[x].flags & Cell::Wide) && x + 1 < cols)
+                line[x + 1] = Cell(' ', line[x + 1].color);
+        }
+
+        // a combining mark, ZWJ sequence or second flag letter extends the glyph left of the cursor
+        bool join(char32_t cp)
+        {
+            bool flag_pair = detail::regional_indicator(cp) && detail::regional_indicator(last_cp);
+            bool joins = (cp >= 0x300 && detail::char_width(cp) == 0) || last_cp == 0x200D || flag_pair;
+            last_cp = flag_pair ? 0 : cp;
+            int x = wrap_pending ? cx : cx - 1;
+            if (!joins || x < 0)
+                return false;
+            Cell *line = &cells[cy * cols];
+            if ((line[x].flags & Cell::Continuation) && x > 0)
+                x--;
+            Cell &base = line[x];
+
+            char bytes[4];
+            std::string text(detail::glyph_bytes(base.ch, bytes));
+            text.append(bytes, detail::utf8_encode(cp, bytes));
+            bool grow = (cp == 0xFE0F || flag_pair) && !(base.flags & Cell::Wide) && x + 1 < cols;
+            base = Cell(detail::glyphs().intern(text, (base.flags & Cell::Wide) || grow ? 2 : 1), base.color);
+            if (grow)
+            {
+                unpair(x + 1);
+                line[x + 1] = Cell::continuation(base.color);
+                if (x + 1 == cols - 1)
+                    wrap_pending = true;
+                else
+                    cx = x + 2;
+            }
+            return true;
+        }
+
+        void print(char32_t ch)
+        {
+            glyphs++;
+            if (ch >= 0x300 && join(ch))
+                return;
+            last_cp = ch;
+            const Cell cell(ch, pen);
+            bool wide = cell.flags & Cell::Wide;
+            if (wrap_pending || (wide && cx == cols - 1)) // a wide glyph never straddles the margin
+            {
+                cx = 0;
+                line_feed();
+                wrap_pending = false;
+            }
+            unpair(cx);
+            cells[cy * cols + cx] = cell;
+            if (wide && cols > 1)
+            {
+                unpair(cx + 1);
+                cells[cy * cols + cx + 1] = Cell::continuation(pen);
+                cx++;
+            }
+            if (cx == cols - 1)
+                wrap_pending = true;
+            else
+                cx++;
+        }
+
+        static COLOR xterm_rgb(int n)
+        {
+            if (n < 16)
+                return COLOR(detail::ansi16_rgb[n][0], detail::ansi16_rgb[n][1], detail::ansi16_rgb[n][2]);
+            if (n >= 232)
+            {
+                uint8_t v = static_cast<uint8_t>(8 + 10 * (n - 232));
+                return COLOR(v, v, v);
+            }
+            static constexpr uint8_t level[6] = {0, 95, 135, 175, 215, 255};
+            n -= 16;
+            return COLOR(level[n / 36], level[n / 6 % 6], level[n % 6]);
+        }
+
+        void sgr(const std::vector<int> &p)
+        {
+            for (size_t i = 0; i < p.size(); i++)
+            {
+                int v = p[i];
+                if (v == 0 || v == 39)
+                    pen = COLOR(COLOR::RESET);
+                else if (v >= 30 && v <= 37)
+                    pen = xterm_rgb(v - 30);
+                else if (v >= 90 && v <= 97)
+                    pen = xterm_rgb(v - 90 + 8);
+                else if (v == 38 && i + 4 < p.size() && p[i + 1] == 2)
+                {
+                    pen = COLOR(static_cast<uint8_t>(p[i + 2]), static_cast<uint8_t>(p[i + 3]), static_cast<uint8_t>(p[i + 4]));
+                    i += 4;
+                }
+                else if (v == 38 && i + 2 < p.size() && p[i + 1] == 5)
+                {
+                    pen = xterm_rgb(std::clamp(p[i + 2], 0, 255));
+                    i += 2;
+                }
+                else if ((v == 48 || v == 58) && i + 1 < p.size())
+                    i += p[i + 1] == 2 ? 4 : 2; // backgrounds and underline colours are not tracked
+            }
+        }
+
+        void csi(char final)
+        {
+            escapes++;
+            bool priv = !params.empty() && params[0] == '?';
+            std::vector<int> p;
+            {
+                int v = -1;
+                for (size_t i = priv ? 1 : 0; i <= params.size(); i++)
+                {
+                    if (i == params.size() || params[i] == ';')
+                    {
+                        p.push_back(v);
+                        v = -1;
+                    }
+                    else if (std::isdigit(static_cast<unsigned char>(params[i])))
+                        v = (v < 0 ? 0 : v * 10) + (params[i] - '0');
+                }
+            }
+            auto arg = [&](size_t i, int fallback) { return i < p.size() && p[i] > 0 ? p[i] : fallback; };
+            if (priv)
+                return; // ?25, ?2026 and friends change nothing on the grid
+
+            if (final != 'm')
+                wrap_pending = false;
+            switch (final)
+            {
+            case 'H': case 'f':
+                cy = std::clamp(arg(0, 1) - 1, 0, rows - 1);
+                cx = std::clamp(arg(1, 1) - 1, 0, cols - 1);
+                break;
+            case 'A': cy = (std::max)(cy - arg(0, 1), cy >= top ? top : 0); break;
+            case 'B': cy = (std::min)(cy + arg(0, 1), cy <= bottom ? bottom : rows - 1); break;
+            case 'C': cx = (std::min)(cx + arg(0, 1), cols - 1); break;
+            case 'D': cx = (std::max)(cx - arg(0, 1), 0); break;
+            case 'G': cx = std::clamp(arg(0, 1) - 1, 0, cols - 1); break;
+            case 'd': cy = std::clamp(arg(0, 1) - 1, 0, rows - 1); break;
+            case 'J':
+            {
+                int mode = p.empty() || p[0] < 0 ? 0 : p[0];
+                size_t at = static_cast<size_t>(cy) * cols + cx;
+                auto from = mode == 0 ? cells.begin() + at : cells.begin();
+                auto to = mode == 1 ? cells.begin() + at + 1 : cells.end();
+                std::fill(from, to, Cell(' ', pen));
+                break;
+            }
+            case 'K':
+            {
+                int mode = p.empty() || p[0] < 0 ? 0 : p[0];
+                auto line = cells.begin() + cy * cols;
+                std::fill(line + (mode == 0 ? cx : 0), mode == 1 ? line + cx + 1 : line + cols, Cell(' ', pen));
+                break;
+            }
+            case 'm':
+                sgr(p);
+                break;
+            case 'r':
+                top = std::clamp(arg(0, 1) - 1, 0, rows - 1);
+                bottom = std::clamp(arg(1, rows) - 1, 0, rows - 1);
+                if (top >= bottom)
+                {
+                    top = 0;
+                    bottom = rows - 1;
+                }
+                cx = cy = 0; // DECSTBM homes the cursor
+                break;
+            case 'S': scroll_up(arg(0, 1)); break;
+            case 'T': scroll_down(arg(0, 1)); break;
+            default: break;
+            }
+        }
+
+    protected:
+        void emit(const char *data, size_t size) override
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                unsigned char b = static_cast<unsigned char>(data[i]);
+                switch (state)
+                {
+                case State::Escape:
+                    if (b == '[')
+                    {
+                        state = State::Csi;
+                        params.clear();
+                        continue;
+                    }
+                    escapes++;
+                    if (b == 'D') line_feed();                                     // IND
+                    else if (b == 'M') { if (cy == top) scroll_down(1); else if (cy > 0) cy--; } // RI
+                    state = State::Ground;
+                    continue;
+                case State::Csi:
+                    if (b >= 0x40 && b <= 0x7e)
+                    {
+                        csi(static_cast<char>(b));
+                        state = State::Ground;
+                    }
+                    else
+                        params.push_back(static_cast<char>(b));
+                    continue;
+                case State::Ground:
+                    break;
+                }
+
+                if (utf8_left > 0 && (b & 0xc0) == 0x80)
+                {
+                    utf8_cp = (utf8_cp << 6) | (b & 0x3f);
+                    if (--utf8_left == 0)
+                        print(utf8_cp);
+                    continue;
+                }
+                utf8_left = 0;
+
+                if (b == 0x1b) state = State::Escape;
+                else if (b == '\r') { cx = 0; wrap_pending = false; }
+                else if (b == '\n') { line_feed(); wrap_pending = false; }
+                else if (b == '\b') { if (cx > 0) cx--; wrap_pending = false; }
+                else if (b < 0x20 || b == 0x7f) {}
+                else if (b < 0x80) print(b);
+                else if ((b & 0xe0) == 0xc0) { utf8_cp = b & 0x1f; utf8_left = 1; }
+                else if ((b & 0xf0) == 0xe0) { utf8_cp = b & 0x0f; utf8_left = 2; }
+                else if ((b & 0xf8) == 0xf0) { utf8_cp = b & 0x07; utf8_left = 3; }
+            }
+        }
+
+    public:
+        VirtualTerminal(int cols = 80, int rows = 24) : cols((std::max)(cols, 1)), rows((std::max)(rows, 1))
+        {
+            cells.assign(this->cols * this->rows, Cell(' ', COLOR::RESET));
+            bottom = this->rows - 1;
+        }
+
+        std::pair<int, int> size() const override { return {cols, rows}; }
+
+        // 1-based like the terminal, so (win.get_x(), win.get_y()) is a window's top-left corner
+        const Cell &at(int x, int y) const { return cells[(y - 1) * cols + (x - 1)]; }
+        std::pair<int, int> cursor() const { return {cx + 1, cy + 1}; }
+
+        // one row as UTF-8, trailing blanks dropped
+        std::string row_text(int y) const
+        {
+            std::string text;
+            const Cell *line = &cells[(y - 1) * cols];
+            int end = cols;
+            while (end > 0 && line[end - 1].ch == ' ')
+                end--;
+            char bytes[4];
+            for (int k = 0; k < end; k++)
+                if (!(line[k].flags & Cell::Continuation))
+                    text.append(detail::glyph_bytes(line[k].ch, bytes));
+            return text;
+        }
+
+        uint64_t escape_count() const { return escapes; }
+        uint64_t glyph_count() const { return glyphs; }
+    };
+
+    namespace detail {
+        // the newest lines of a log window, oldest overwritten first; slots keep their strings so appends stop allocating
+        struct LogRing
+        {
+            struct Line
+            {
+                std::string text;
+                COLOR color;
+            };
+            std::vector<Line> lines;
+            size_t head = 0;    // next slot to write
+            size_t total = 0;   // lines ever appended
+            size_t shown = 0;   // `total` when the window last caught up
+
+            void reset(size_t capacity)
+            {
+                lines.assign(capacity, Line{std::string(), COLOR(COLOR::RESET)});
+                head = total = shown = 0;
+            }
+
+            void push(std::string_view text, const COLOR &color)
+            {
+                Line &line = lines[head];
+                line.text.assign(text.data(), text.size());
+                line.color = color;
+                head = (head + 1) % lines.size();
+                total++;
+            }
+
+            // k = 0 is the newest line
+            const Line &newest(size_t k) const { return lines[(head + lines.size() - 1 - k) % lines.size()]; }
+        };
+    }
+
+    namespace detail {
+        // LEB128, every integer in a recording is one of these
+        inline void put_varint(std::string &out, uint64_t v)
+        {
+            while (v >= 0x80)
+            {
+                out.push_back(static_cast<char>(v | 0x80));
+                v >>= 7;
+            }
+            out.push_back(static_cast<char>(v));
+        }
+
+        // the same into a buffer known to have room, at most 10 bytes
+        inline char *put_varint(char *out, uint64_t v)
+        {
+            while (v >= 0x80)
+            {
+                *out++ = static_cast<char>(v | 0x80);
+                v >>= 7;
+            }
+            *out++ = static_cast<char>(v);
+            return out;
+        }
+
+        inline uint64_t get_varint(const uint8_t *&p, const uint8_t *end)
+        {
+            uint64_t v = 0;
+            for (int shift = 0; p < end && shift < 64; shift += 7)
+            {
+                uint8_t byte = *p++;
+                v |= uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return v;
+            }
+            throw std::out_of_range("\nERROR: Recording is truncated or corrupt");
+        }
+
+        // recording layout: "ECHOREC1" cols rows, then records of <type byte> [time_us] <length> <payload>.
+        // 'P' appends colours to the palette, 'G' clusters to the glyph list (<width> <length> <UTF-8 bytes> each),
+        // 'K' is a keyframe and 'D' a delta, both a list of items:
+        //   even tag: run of cells starting (tag >> 1, zigzag signed) cells after the previous run ended, then its length and the cells
+        //   odd tag:  terminal scroll of rows top..bottom by n, applied to the canvas as the terminal did
+        // cells are <(repeat - 1) << 1 | colour follows> [palette index] <code point>, the colour carrying over;
+        // code point 0 is the right half of a wide glyph and record_glyph_base + k the k-th glyph of the list.
+        // a closed recording ends with an 'I' index record (keyframe offsets, palette, glyphs) and a 16 byte trailer
+        inline constexpr std::string_view record_magic = "ECHOREC1";
+        inline constexpr std::string_view record_end_magic = "ECHOEND1";
+        inline constexpr char32_t record_glyph_base = 0x110000; // past the last code point
+
+        // a small blocking queue between pipeline stages; close() wakes everyone, pop() still drains what is left
+        template <typename T>
+        class BoundedQueue
+        {
+        private:
+            std::mutex lock;
+            std::condition_variable not_empty, not_full;
+            std::deque<T> items;
+            size_t capacity;
+            bool closed = false;
+
+        public:
+            explicit BoundedQueue(size_t capacity) : capacity((std::max)(capacity, size_t(1))) {}
+
+            // waits for room, false once the queue is closed
+            bool push(T item)
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+                if (closed)
+                    return false;
+                items.push_back(std::move(item));
+                not_empty.notify_one();
+                return true;
+            }
+
+            // never waits: when full, the oldest entry makes room and is handed back through `evicted`
+            bool push_latest(T item, T &evicted)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                bool full = items.size() >= capacity;
+                if (full)
+                {
+                    evicted = std::move(items.front());
+                    items.pop_front();
+                }
+                items.push_back(std::move(item));
+                not_empty.notify_one();
+                return full;
+            }
+
+            // never waits, false when full (or closed) and the item stays with the caller
+            bool try_push(T &item)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (closed || items.size() >= capacity)
+                    return false;
+                items.push_back(std::move(item));
+                not_empty.notify_one();
+                return true;
+            }
+
+            // waits for an item, false once the queue is closed and empty
+            bool pop(T &item)
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                not_empty.wait(guard, [this] { return closed || !items.empty(); });
+                if (items.empty())
+                    return false;
+                item = std::move(items.front());
+                items.pop_front();
+                not_full.notify_one();
+                return true;
+            }
+
+            bool try_pop(T &item)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (items.empty())
+                    return false;
+                item = std::move(items.front());
+                items.pop_front();
+                not_full.notify_one();
+                return true;
+            }
+
+            void close()
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                closed = true;
+                not_empty.notify_all();
+                not_full.notify_all();
+            }
+        };
+    }
+
+    class Recorder
+    { // keeps what windows and screens render as timestamped cell deltas with periodic keyframes, replay it with Replay
+    private:
+        friend class Window;
+        friend class Screen;
+
+        struct Key { uint64_t time_us, offset; };
+
+        FILE *file;
+        int cols, rows;
+        microseconds keyframe_every, resolution;
+        steady_clock::time_point start = steady_clock::now();
+
+        // renderers write their changes straight into the stage; the writer thread takes what changed at most once
+        // per `resolution` and does the encoding and the file. frames rendered in between become one delta
+        detail::DamageTap stage;
+        std::mutex stage_lock;
+        std::condition_variable staged;
+        bool stage_fresh = false;  // changes since the last take, guarded by stage_lock like the fields below
+        bool closing = false;
+        uint64_t stage_us = 0;     // when the last of them was encoded
+        std::thread writer;
+        std::mutex close_lock;
+        std::atomic<bool> closed{false};
+        std::atomic<uint64_t> frames{0}, written{0};
+
+        // writer thread only
+        std::vector<Cell> canvas;       // the recorded terminal as of the last delta
+        std::vector<uint32_t> touched;  // canvas positions this delta wrote, ascending
+        std::vector<detail::DamageTap::Scroll> scrolls;
+        std::unordered_map<uint32_t, uint32_t> palette_index;
+        std::array<uint64_t, 256> palette_cache{}; // rgb << 32 | index + 1, most cells hit here and skip the map
+        std::vector<COLOR> palette;
+        size_t palette_written = 0;
+        std::unordered_map<char32_t, uint32_t> glyph_index; // interned id to its place in the recording's glyph list
+        std::vector<char32_t> glyph_list;
+        size_t glyphs_written = 0;
+        std::string buffer, payload, held;
+        uint64_t offset = 0; // file position of buffer[0]
+        std::vector<Key> keys;
+        uint64_t last_us = 0;
+
+        uint32_t color_index(const COLOR &color)
+        {
+            uint32_t rgb = uint32_t(color.r) << 16 | uint32_t(color.g) << 8 | color.b;
+            uint64_t &cached = palette_cache[(rgb * 0x9E3779B1u) >> 24];
+            if (cached >> 32 == rgb && uint32_t(cached))
+                return uint32_t(cached) - 1;
+
+            auto [it, added] = palette_index.try_emplace(rgb, static_cast<uint32_t>(palette.size()));
+            if (added)
+                palette.push_back(color);
+            cached = uint64_t(rgb) << 32 | (it->second + 1);
+            return it->second;
+        }
+
+        void put_cells(const Cell *cells, size_t n, uint32_t &pen)
+        {
+            // a run is at most three varints of 10 bytes, written straight into the payload with no per-byte checks
+            size_t at = payload.size();
+            payload.resize_and_overwrite(at + n * 30, [&](char *buf, size_t) {
+                char *p = buf + at;
+                for (size_t k = 0; k < n;)
+                {
+                    size_t repeat = 1;
+                    while (k + repeat < n && cells[k + repeat] == cells[k])
+                        repeat++;
+                    uint32_t color = k && cells[k].color == cells[k - 1].color ? pen : color_index(cells[k].color);
+                    bool changed = color != pen;
+                    p = detail::put_varint(p, uint64_t(repeat - 1) << 1 | changed);
+                    if (changed)
+                        p = detail::put_varint(p, pen = color);
+                    p = detail::put_varint(p, glyph_code(cells[k].ch));
+                    k += repeat;
+                }
+                return static_cast<size_t>(p - buf);
+            });
+        }
+
+        // interned ids only mean something in this process, the recording numbers its clusters itself
+        char32_t glyph_code(char32_t ch)
+        {
+            if (!(ch & detail::glyph_tag))
+                return ch;
+            auto [it, added] = glyph_index.try_emplace(ch, static_cast<uint32_t>(glyph_list.size()));
+            if (added)
+                glyph_list.push_back(ch);
+            return detail::record_glyph_base + it->second;
+        }
+
+        void put_glyphs(size_t from)
+        {
+            for (size_t k = from; k < glyph_list.size(); k++)
+            {
+                const detail::GlyphTable::Entry &glyph = detail::glyphs().at(glyph_list[k]);
+                detail::put_varint(payload, glyph.width);
+                detail::put_varint(payload, glyph.bytes.size());
+                payload += glyph.bytes;
+            }
+        }
+
+        void put_record(char type, uint64_t time_us, bool timed)
+        {
+            buffer.push_back(type);
+            if (timed)
+                detail::put_varint(buffer, time_us);
+            detail::put_varint(buffer, payload.size());
+            buffer += payload;
+            if (buffer.size() >= 64 * 1024)
+                write_out();
+        }
+
+        void write_out()
+        {
+            std::fwrite(buffer.data(), 1, buffer.size(), file);
+            offset += buffer.size();
+            written.store(offset, std::memory_order_relaxed);
+            buffer.clear();
+        }
+
+        // a renderer holds the stage while it encodes, and lets go before it writes to the terminal so the writer's
+        // take never waits on that I/O. nullptr once closed
+        detail::DamageTap *begin(std::unique_lock<std::mutex> &hold)
+        {
+            hold = std::unique_lock<std::mutex>(stage_lock);
+            if (closing)
+            {
+                hold.unlock();
+                return nullptr;
+            }
+            return &stage;
+        }
+
+        // `changed` is false for a frame that wrote nothing, the writer is not woken for it
+        void end(std::unique_lock<std::mutex> &hold, bool changed = true)
+        {
+            if (!changed)
+            {
+                hold.unlock();
+                return;
+            }
+            stage_us = static_cast<uint64_t>(duration_cast<microseconds>(steady_clock::now() - start).count());
+            bool wake = !stage_fresh;
+            stage_fresh = true;
+            hold.unlock();
+            if (wake) // once per take, not once per frame
+                staged.notify_one();
+        }
+
+        // caller holds stage_lock: move everything changed since the last take into the canvas
+        uint64_t take()
+        {
+            scrolls.swap(stage.scrolls);
+            stage.scrolls.clear();
+            for (const detail::DamageTap::Scroll &s : scrolls)
+            {
+                int top = (std::max)(s.top, 1), bottom = (std::min)(s.bottom, rows);
+                int n = (std::min)(s.n, bottom - top + 1);
+                if (n <= 0)
+                    continue;
+                Cell *region = &canvas[(top - 1) * size_t(cols)];
+                std::move(region + n * size_t(cols), region + (bottom - top + 1) * size_t(cols), region);
+                std::fill(region + (bottom - top + 1 - n) * size_t(cols), region + (bottom - top + 1) * size_t(cols), Cell());
+            }
+
+            touched.clear();
+            for (int r = 0; r < rows; r++)
+            {
+                uint64_t *bits = &stage.marks[r * size_t(stage.words)];
+                for (int w = 0; w < stage.words; w++)
+                {
+                    for (uint64_t word = bits[w]; word; word &= word - 1)
+                    {
+                        uint32_t pos = static_cast<uint32_t>(r * size_t(cols) + w * 64 + std::countr_zero(word));
+                        if (canvas[pos] == stage.cells[pos])
+                            continue; // written again with what it already showed
+                        canvas[pos] = stage.cells[pos];
+                        touched.push_back(pos);
+                    }
+                    bits[w] = 0;
+                }
+            }
+            stage_fresh = false;
+            return stage_us;
+        }
+
+        // append what the last take collected as a delta, or as a keyframe when one is due
+        void encode(uint64_t time_us)
+        {
+            payload.clear();
+            for (const detail::DamageTap::Scroll &s : scrolls)
+            {
+                int top = (std::max)(s.top, 1), bottom = (std::min)(s.bottom, rows);
+                int n = (std::min)(s.n, bottom - top + 1);
+                if (n <= 0)
+                    continue;
+                detail::put_varint(payload, 1);
+                detail::put_varint(payload, top);
+                detail::put_varint(payload, bottom);
+                detail::put_varint(payload, n);
+            }
+            if (payload.empty() && touched.empty())
+                return;
+
+            uint64_t now_us = last_us = (std::max)(time_us, last_us);
+            frames.fetch_add(1, std::memory_order_relaxed);
+
+            uint32_t pen = 0;
+            bool keyframe = keys.empty() || now_us - keys.back().time_us >= static_cast<uint64_t>(keyframe_every.count());
+            if (keyframe)
+            {
+                payload.clear(); // the whole canvas already includes any scroll
+                detail::put_varint(payload, 0);
+                detail::put_varint(payload, canvas.size());
+                put_cells(canvas.data(), canvas.size(), pen);
+            }
+            else
+            {
+                // a gap of one cell is cheaper inside a run
+                int64_t end = 0;
+                for (size_t k = 0; k < touched.size();)
+                {
+                    size_t last = k;
+                    while (last + 1 < touched.size() && touched[last + 1] > touched[last] && touched[last + 1] - touched[last] <= 2)
+                        last++;
+                    uint32_t first = touched[k], stop = touched[last] + 1;
+                    int64_t gap = int64_t(first) - end;
+                    detail::put_varint(payload, (uint64_t(gap) << 1 ^ uint64_t(gap >> 63)) << 1);
+                    detail::put_varint(payload, stop - first);
+                    put_cells(&canvas[first], stop - first, pen);
+                    end = stop;
+                    k = last + 1;
+                }
+            }
+
+            if (palette.size() > palette_written)
+            {
+                payload.swap(held); // the frame's cells wait in `held`, both keep their capacity
+                payload.clear();
+                detail::put_varint(payload, palette_written);
+                for (size_t k = palette_written; k < palette.size(); k++)
+                {
+                    payload.push_back(static_cast<char>(palette[k].r));
+                    payload.push_back(static_cast<char>(palette[k].g));
+                    payload.push_back(static_cast<char>(palette[k].b));
+                }
+                palette_written = palette.size();
+                put_record('P', 0, false);
+                payload.swap(held);
+            }
+            if (glyph_list.size() > glyphs_written)
+            {
+                payload.swap(held);
+                payload.clear();
+                detail::put_varint(payload, glyphs_written);
+                put_glyphs(glyphs_written);
+                glyphs_written = glyph_list.size();
+                put_record('G', 0, false);
+                payload.swap(held);
+            }
+
+            if (keyframe)
+                keys.push_back({now_us, offset + buffer.size()});
+            put_record(keyframe ? 'K' : 'D', now_us, true);
+        }
+
+        void write_loop()
+        {
+            std::unique_lock<std::mutex> lock(stage_lock);
+            auto last_take = steady_clock::now() - resolution;
+            for (;;)
+            {
+                staged.wait(lock, [&] { return stage_fresh || closing; });
+                if (!closing)
+                    staged.wait_until(lock, last_take + resolution, [&] { return closing; }); // let more frames gather
+                if (!stage_fresh)
+                    return; // closing, and nothing left
+                uint64_t time_us = take();
+                last_take = steady_clock::now();
+                lock.unlock();
+                encode(time_us);
+                lock.lock();
+            }
+        }
+
+    public:
+        // cols x rows is the terminal being recorded, a keyframe goes in at least every keyframe_every so seeking stays cheap.
+        // frames less than `resolution` apart are stored as one delta, by default about one refresh of a 60 Hz display
+        Recorder(const std::string &path, int cols, int rows, milliseconds keyframe_every = milliseconds(1000),
+                 milliseconds resolution = milliseconds(16))
+            : cols((std::max)(cols, 1)), rows((std::max)(rows, 1)), keyframe_every(keyframe_every), resolution(resolution)
+        {
+            file = std::fopen(path.c_str(), "wb");
+            if (!file)
+                throw std::invalid_argument("\nERROR: Cannot open " + path + " for writing");
+            canvas.assign(size_t(this->cols) * this->rows, Cell());
+            stage.resize(this->cols, this->rows);
+            touched.reserve(canvas.size()); // a delta never touches more than every cell, so the writer does not allocate
+            payload.reserve(canvas.size() * 4);
+            buffer.reserve(64 * 1024 + payload.capacity());
+            color_index(Cell().color); // index 0, the pen every record starts with
+
+            buffer = detail::record_magic;
+            detail::put_varint(buffer, this->cols);
+            detail::put_varint(buffer, this->rows);
+            writer = std::thread([this] { write_loop(); });
+        }
+        explicit Recorder(const std::string &path, const Sink &sink = default_sink(), milliseconds keyframe_every = milliseconds(1000),
+                          milliseconds resolution = milliseconds(16))
+            : Recorder(path, sink.size().first, sink.size().second, keyframe_every, resolution) {}
+
+        ~Recorder() { close(); }
+        Recorder(const Recorder &) = delete;
+        Recorder &operator=(const Recorder &) = delete;
+
+        // write out what is still staged, append the seek index and close the file; detach the recorder from its windows first
+        void close()
+        {
+            std::lock_guard<std::mutex> guard(close_lock);
+            if (closed.exchange(true))
+                return;
+            {
+                std::lock_guard<std::mutex> lock(stage_lock);
+                closing = true;
+            }
+            staged.notify_one();
+            writer.join();
+
+            payload.clear();
+            detail::put_varint(payload, frames.load());
+            detail::put_varint(payload, last_us);
+            detail::put_varint(payload, keys.size());
+            for (const Key &key : keys)
+            {
+                detail::put_varint(payload, key.time_us);
+                detail::put_varint(payload, key.offset);
+            }
+            detail::put_varint(payload, palette.size());
+            for (const COLOR &color : palette)
+            {
+                payload.push_back(static_cast<char>(color.r));
+                payload.push_back(static_cast<char>(color.g));
+                payload.push_back(static_cast<char>(color.b));
+            }
+            detail::put_varint(payload, glyph_list.size());
+            put_glyphs(0);
+            uint64_t index_at = offset + buffer.size();
+            put_record('I', 0, false);
+
+            char trailer[8];
+            for (int k = 0; k < 8; k++)
+                trailer[k] = static_cast<char>(index_at >> (8 * k));
+            buffer.append(trailer, 8);
+            buffer += detail::record_end_magic;
+            write_out();
+            std::fclose(file);
+        }
+
+        size_t frame_count() const { return frames.load(std::memory_order_relaxed); }
+        // what has reached the file so far, the writer buffers up to 64 KiB
+        uint64_t bytes_written() const { return written.load(std::memory_order_relaxed); }
+    };
+
+    class Screen;
+
+    class Window
+    {
+    private:
+        friend class Screen;
+
+        int x, y;
+        int width, height;
+        int r, c;
+        std::string title;
+        std::vector<Cell> title_row; // the top border between the corners, the title already decoded into cells
+
+        detail::DamageGrid grid;
+        std::vector<float> depth; // optional z-buffer, row-major, empty until enable_depth()
+        FrameEncoder out;
+        ColorMode color_mode = ColorMode::TrueColor;
+        bool parallel_encode = true;
+        ThreadPool *encode_pool = nullptr; // default_pool() when null
+        Screen *screen = nullptr; // set when the window is composed by a Screen instead of drawing itself
+
+        ECHO_STAT(detail::StatCounters stats;)
+
+        Recorder *recorder = nullptr;
+
+        detail::LogRing log_ring;   // empty until the first log()
+        bool log_scrolls = false;   // the interior spans whole terminal rows, so the terminal can do the scrolling
+        bool log_scrolls_set = false;
+
+        // frames handed to the Screen's render thread, allocated the first time that thread runs and kept after it stops,
+        // so a producer still inside publish() never touches freed memory; `publishing` is what switches modes
+        std::unique_ptr<detail::TripleBuffer<detail::aligned_vector<Cell>>> published;
+        std::atomic<bool> publishing{false};
+
+        // what the compositor may read: the last published frame in threaded mode, the live buffer otherwise
+        const Cell* composed_cells() const
+        {
+            return publishing.load(std::memory_order_relaxed) ? published->read_buffer().data() : grid.back.data();
+        }
+
+        // ----------------- CORE PRIMITIVES -----------------
+        // msg is UTF-8, one cell per cluster (two for wide ones); returns the column after the text
+        int move_string_to_cell(int row_index, std::string_view msg, int start_col, const COLOR& color)
+        {
+            int col = start_col;
+            for (size_t at = 0; at < msg.size() && col < grid.cols;)
+            {
+                detail::Cluster cluster = detail::next_cluster(msg, at);
+                grid.set(row_index, col, Cell(detail::cluster_char(msg, at, cluster), color)); // a wide glyph cut by the edge is a blank
+                col += cluster.width;
+                at = cluster.end;
+            }
+            return (std::min)(col, grid.cols);
+        }
+
+        std::string_view trim_string(const std::string &msg, size_t max_length) {
+            return std::string_view(msg).substr(0, detail::fit_columns(msg, max_length));
+        }
+
+        // decoded once, centred by display width rather than by bytes
+        void layout_title()
+        {
+            int inner = (std::max)(width - 2, 0);
+            title_row.assign(inner, Cell('-'));
+            std::string_view shown = trim_string(title, inner);
+            int col = (inner - static_cast<int>(detail::text_width(shown))) / 2;
+            for (size_t at = 0; at < shown.size();)
+            {
+                detail::Cluster cluster = detail::next_cluster(shown, at);
+                Cell cell(detail::cluster_char(shown, at, cluster));
+                title_row[col] = cell;
+                if ((cell.flags & Cell::Wide) && col + 1 < inner)
+                    title_row[col + 1] = Cell::continuation(cell.color);
+                col += cluster.width;
+                at = cluster.end;
+            }
+        }
+
+        // the border/inside cell at offset (px, py) from the window's top-left corner
+        Cell frame_cell(int px, int py) const
+        {
+            if (py > 0 && py < height - 1 && px > 0 && px < width - 1)
+                return composed_cells()[(py - 1) * grid.stride + px - 1];
+            if (py > 0 && py < height - 1)
+                return Cell('|');
+            if (px == 0 || px == width - 1)
+                return Cell('+');
+            if (py == 0)
+                return title_row[px - 1];
+            return Cell('-');
+        }
+
+        void clear_line(int px, int py)
+        {
+            int cx = x + 1 + px;
+            int cy = y + 1 + py;
+            out.move_to(cx, cy);
+            out.put(' ', width - 2);
+
+            std::lock_guard<std::mutex> lock(screen_lock);
+            out.flush();
+        }
+
+        void draw_border()
+        {
+            out.put(COLOR::asANSI(COLOR::RESET));
+            out.move_to(x, y);
+
+            out.put('+');
+            for (const Cell &cell : title_row)
+                if (!(cell.flags & Cell::Continuation)) // drawn along with the wide glyph to its left
+                    out.glyph(cell);
+            out.put('+');
+
+            for (int i = 1; i < height - 1; i++)
+            {
+                out.move_to(x, y + i);
+                out.put('|');
+                out.put(' ', width - 2);
+                out.put('|');
+            }
+
+            out.move_to(x, y + height - 1);
+            out.put('+');
+            out.put('-', width - 2);
+            out.put('+');
+
+            std::lock_guard<std::mutex> lock(screen_lock);
+            out.flush();
+        }
+
+        // bring the grid up to the newest log lines, returns how many rows the terminal itself should scroll.
+        // rows already on screen are shifted with it, so only the lines appended since last time get written
+        int sync_log(bool terminal_scroll)
+        {
+            size_t appended = log_ring.total - log_ring.shown;
+            if (appended == 0)
+                return 0;
+            size_t rows = grid.rows;
+            size_t overflow_before = log_ring.shown > rows ? log_ring.shown - rows : 0;
+            size_t overflow_after = log_ring.total > rows ? log_ring.total - rows : 0;
+            size_t scroll = overflow_after - overflow_before;
+            log_ring.shown = log_ring.total;
+
+            size_t visible = (std::min)(log_ring.total, rows);
+            size_t rewrite = visible; // a burst of a whole window or more replaces everything
+            if (terminal_scroll && scroll < rows)
+            {
+                grid.scroll_up(static_cast<int>(scroll));
+                rewrite = (std::min)(appended, visible);
+            }
+            else
+            {
+                scroll = 0;
+            }
+
+            const Cell blank(' ', COLOR::RESET);
+            for (size_t row = visible - rewrite; row < visible; row++)
+            {
+                const detail::LogRing::Line &line = log_ring.newest(visible - 1 - row);
+                int row_i = static_cast<int>(row);
+                int len = move_string_to_cell(row_i, line.text, 0, line.color);
+                for (int col = len; col < grid.cols; col++)
+                    grid.set(row_i, col, blank);
+            }
+            return static_cast<int>(scroll);
+        }
+
+        // composed windows are built by Screen::add_window and never touch the terminal themselves
+        Window(Screen &owner, int x, int y, int w, int h, std::string title)
+            : x(x), y(y), width(w), height(h), r(0), c(1), title(std::move(title)), screen(&owner) {
+            max_height = (std::max)(max_height, y + h);
+            layout_title();
+            grid.resize(h - 2, w - 2);
+        }
+
+        public:
+        Window(int x, int y, int w, int h, std::string title = "", Sink &sink = default_sink())
+            : x(x), y(y), width(w), height(h), r(0), c(1), title(title) {
+            max_height = (std::max)(max_height, y + h);
+            out.set_sink(sink);
+            out.set_right_edge(sink.size().first);
+            layout_title();
+            draw_border();
+
+            grid.resize(h - 2, w - 2); // draw_border has just blanked the inside, so front starts out blank too
+        }
+
+        ~Window() {
+            if (!screen)
+            {
+                std::lock_guard<std::mutex> lock(screen_lock);
+                out.get_sink().write(COLOR::asANSI(COLOR::RESET));
+            }
+        }
+
+        void clear_inside();
+
+        void clean_buffer() {
+            const Cell blank(' ', COLOR::RESET);
+
+            for (int i = 0; i < grid.rows; i++)
+            {
+                for (int j = 0; j < grid.cols; j++)
+                    grid.set(i, j, blank);
+            }
+            clear_depth();
+        }
+
+        // ----------------- DEPTH BUFFER -----------------
+        void enable_depth(bool enabled = true)
+        {
+            if (enabled)
+                depth.assign(grid.rows * grid.cols, std::numeric_limits<float>::infinity());
+            else
+                std::vector<float>().swap(depth);
+        }
+
+        bool has_depth() const { return !depth.empty(); }
+
+        // clean_buffer() already does this, call it directly when redrawing without clearing the cells
+        void clear_depth() { std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::infinity()); }
+
+        // true, and z is recorded, when the fragment is nearer than what the cell holds (or there is no depth buffer)
+        bool depth_test(int row, int col, float z)
+        {
+            if (depth.empty())
+                return true;
+            float &stored = depth[row * grid.cols + col];
+            if (!(z < stored))
+                return false;
+            stored = z;
+            return true;
+        }
+
+        // ----------------- PUBLIC PRINT FUNCTIONS -----------------
+        void print_msg(const std::string_view &msg, const COLOR& color = COLOR(COLOR::RESET))
+        {
+            if (detail::text_width(msg) > static_cast<size_t>(width - 2))
+                throw std::out_of_range("\nERROR: Message length exceeds window width in print_msg");
+            move_string_to_cell(r, msg, 0, color);
+            (++r) %= grid.rows;
+            c = 1;
+        }
+
+        void print_msgln(const std::string &msg, const COLOR& color = COLOR(COLOR::RESET))
+        {
+            size_t columns = detail::text_width(msg);
+            if (columns > static_cast<size_t>(width - 2))
+            {
+                print_msg(trim_string(msg, width - 2), color);
+            }
+            else
+            {
+                int append_chars = (width - 2) - static_cast<int>(columns);
+                std::string full_msg = msg + std::string(append_chars > 0 ? append_chars : 0, ' ');
+                print_msg(full_msg, color);
+            }
+        }
+
+        void print_line(char ch = '-', const COLOR& color = COLOR(COLOR::RESET))
+        {
+            std::string line(width - 2, ch);
+            print_msg(line, color);
+        }
+
+        void print(int row, int col, std::string_view msg, const COLOR& color = COLOR(COLOR::RESET))
+        {
+            move_string_to_cell(row, msg, col, color);
+        }
+
+        // one cell, no string in between; the caller keeps (row, col) inside the window
+        void set_cell(int row, int col, char32_t ch, const COLOR& color = COLOR(COLOR::RESET))
+        {
+            grid.set(row, col, Cell(ch, color));
+        }
+        void set_cell(int row, int col, char ch, const COLOR& color = COLOR(COLOR::RESET))
+        {
+            grid.set(row, col, Cell(ch, color));
+        }
+
+        // `count` copies of one glyph from (row, col), clipped to the window
+        void fill_span(int row, int col, int count, char32_t ch, const COLOR& color = COLOR(COLOR::RESET))
+        {
+            if (row < 0 || row >= grid.rows)
+                return;
+            int end = (std::min)(col + count, grid.cols);
+            const Cell cell(ch, color);
+            int step = (cell.flags & Cell::Wide) ? 2 : 1;
+            for (int j = (std::max)(col, 0); j + step <= end; j += step)
+                grid.set(row, j, cell);
+        }
+        void fill_span(int row, int col, int count, char ch, const COLOR& color = COLOR(COLOR::RESET))
+        {
+            fill_span(row, col, count, char32_t(static_cast<unsigned char>(ch)), color);
+        }
+
+        // copy a rows x cols block of caller-owned cells to (row, col), clipped to the window;
+        // strides are in elements, so the source can be a sub-rectangle of a larger frame.
+        // nothing is copied up front and only the cells that differ from what the window holds get dirtied
+        void blit(const Cell *cells, size_t stride, int rows, int cols, int row = 0, int col = 0)
+        {
+            int r0 = (std::max)(row, 0), r1 = (std::min)(row + rows, grid.rows);
+            int c0 = (std::max)(col, 0), c1 = (std::min)(col + cols, grid.cols);
+            for (int r = r0; r < r1 && c0 < c1; r++)
+                grid.blit_row(r, c0, cells + (r - row) * stride + (c0 - col), c1 - c0);
+        }
+        // same, from separate planes of chars and packed RGB
+        void blit(const char *chars, size_t chars_stride, const COLOR *colors, size_t colors_stride, int rows, int cols, int row = 0, int col = 0)
+        {
+            int r0 = (std::max)(row, 0), r1 = (std::min)(row + rows, grid.rows);
+            int c0 = (std::max)(col, 0), c1 = (std::min)(col + cols, grid.cols);
+            for (int r = r0; r < r1 && c0 < c1; r++)
+                grid.blit_row(r, c0, chars + (r - row) * chars_stride + (c0 - col), colors + (r - row) * colors_stride + (c0 - col), c1 - c0);
+        }
+
+        // ----------------- LOG MODE -----------------
+        // tail the window: lines go into a ring of the newest `rows` lines, the window shows them top-down and
+        // scrolls once full. appends are only buffered here, render() coalesces them into one scroll and the new lines
+        void log(std::string_view msg, const COLOR& color = COLOR(COLOR::RESET))
+        {
+            if (grid.rows <= 0 || grid.cols <= 0)
+                return;
+            if (log_ring.lines.empty())
+            {
+                log_ring.reset(grid.rows);
+                // DECSTBM scrolls whole terminal rows, which is only safe when nothing else shares them;
+                // the border columns look the same on every row, so they may move along
+                if (!log_scrolls_set)
+                    log_scrolls = !screen && grid.rows >= 2 && x <= 1 && x + width - 1 >= out.get_sink().size().first;
+            }
+
+            // one entry per line of text, long lines wrap onto the next row
+            if (!msg.empty() && msg.back() == '\n')
+                msg.remove_suffix(1);
+            while (true)
+            {
+                size_t end = msg.find('\n');
+                std::string_view line = msg.substr(0, end);
+                do
+                {
+                    size_t fit = detail::fit_columns(line, grid.cols);
+                    if (fit == 0 && !line.empty()) // a wide glyph in a one-column window
+                        fit = detail::next_cluster(line, 0).end;
+                    log_ring.push(line.substr(0, fit), color);
+                    line.remove_prefix(fit);
+                } while (!line.empty());
+                if (end == std::string_view::npos)
+                    break;
+                msg.remove_prefix(end + 1);
+            }
+        }
+
+        // force terminal scrolling on or off for log(), e.g. on when a narrower window is known to have its rows to itself
+        void set_log_scrolling(bool enabled)
+        {
+            log_scrolls = enabled && !screen && grid.rows >= 2;
+            log_scrolls_set = true;
+        }
+
+        // a window owned by a Screen has nothing to emit here, its damage goes out with the next Screen::render()
+        // when that Screen runs a render thread this publishes the frame instead, without ever blocking
+        void render(bool clear_first=false)
+        {
+            if (clear_first) clear_inside(); // use it with visalizer
+            if (screen)
+            {
+                sync_log(false);
+                if (publishing.load(std::memory_order_acquire))
+                    publish();
+                return;
+            }
+
+            std::unique_lock<std::mutex> staged;
+            if (recorder)
+                out.tap = recorder->begin(staged);
+
+            out.begin_frame();
+            ECHO_STAT(uint64_t encode_start = detail::now_ns();)
+            if (int scroll = sync_log(log_scrolls))
+            {
+                // rows come in blank at the bottom of the region, border included
+                out.scroll_up(y + 1, y + grid.rows, scroll);
+                out.put(COLOR::asANSI(COLOR::RESET));
+                for (int row = y + 1 + grid.rows - scroll; row <= y + grid.rows; row++)
+                {
+                    out.move_to(x, row);
+                    out.put('|');
+                    out.move_to(x + width - 1, row);
+                    out.put('|');
+                    if (out.tap)
+                    {
+                        out.tap->add(x, row, Cell('|'));
+                        out.tap->add(x + width - 1, row, Cell('|'));
+                    }
+                }
+                out.begin_frame();
+            }
+            grid.encode(out, x + 1, y + 1, color_mode, parallel_encode, encode_pool);
+            ECHO_STAT(out.tally.encode_ns += detail::now_ns() - encode_start;)
+
+            if (out.tap)
+            { // staged once encoded: the recorder's writer never waits on the terminal write below
+                out.tap = nullptr;
+                recorder->end(staged, out.size() != 0);
+            }
+
+            ECHO_STAT(uint64_t wait_start = detail::now_ns();)
+            {
+                std::lock_guard<std::mutex> lock(screen_lock);
+                ECHO_STAT(out.tally.lock_wait_ns += detail::now_ns() - wait_start;)
+                out.flush();
+            }
+            ECHO_STAT(
+                out.tally.frames = 1;
+                stats.add(out.tally);
+                detail::global_stats.add(out.tally);
+                out.tally = FrameStats();
+            )
+        }
+
+        // record every frame this window renders from now on, starting with what it shows already; nullptr stops.
+        // a window owned by a Screen is recorded with its Screen
+        void record(Recorder *target)
+        {
+            if (screen)
+                throw std::invalid_argument("\nERROR: Record the Screen that owns this window instead");
+            recorder = target;
+            if (!target)
+                return;
+
+            std::unique_lock<std::mutex> staged;
+            detail::DamageTap *tap = target->begin(staged);
+            if (!tap)
+                return;
+            const Cell edge('|');
+            tap->add(x, y, Cell('+'));
+            tap->add(x + width - 1, y, Cell('+'));
+            tap->add(x, y + height - 1, Cell('+'));
+            tap->add(x + width - 1, y + height - 1, Cell('+'));
+            for (int j = 0; j < width - 2; j++)
+            {
+                tap->add(x + 1 + j, y, title_row[j]);
+                tap->add(x + 1 + j, y + height - 1, Cell('-'));
+            }
+            for (int i = 0; i < grid.rows; i++)
+            {
+                tap->add(x, y + 1 + i, edge);
+                for (int j = 0; j < grid.cols; j++)
+                    tap->add(x + 1 + j, y + 1 + i, grid.front[i * grid.stride + j]);
+                tap->add(x + width - 1, y + 1 + i, edge);
+            }
+            target->end(staged);
+        }
+
+        // what this window has rendered so far; all zero when stats are compiled out
+        FrameStats stats_snapshot() const
+        {
+#if ECHO_ENABLE_STATS
+            return stats.snapshot();
+#else
+            return FrameStats();
+#endif
+        }
+
+        // only used when the window draws itself, composed windows follow their Screen
+        void set_color_mode(ColorMode mode) { color_mode = mode; }
+
+        // heavily damaged frames are encoded in row bands across a pool (default_pool() unless given), on by default
+        void set_parallel_encoding(bool enabled, ThreadPool *pool = nullptr)
+        {
+            parallel_encode = enabled;
+            encode_pool = pool;
+        }
+
+        void publish()
+        {
+            detail::aligned_vector<Cell> &slot = published->write_buffer();
+            std::copy(grid.back.begin(), grid.back.end(), slot.begin());
+            bool missed = published->publish();
+            ECHO_STAT(if (missed) { stats.drop(); detail::global_stats.drop(); })
+            (void)missed;
+
+            // the render thread diffs whole frames, so the bits have nobody left to read them
+            std::fill(grid.dirty.begin(), grid.dirty.end(), 0);
+            std::fill(grid.row_dirty.begin(), grid.row_dirty.end(), 0);
+        }
+
+        int get_h() const { return height - 2; }
+        int get_w() const { return width - 2; }
+        int get_x() const { return x; }
+        int get_y() const { return y; }
+        int get_rows() const { return grid.rows; }
+        int get_cols() const { return grid.cols; }
+    };
+
+    class Screen
+    { // owns the terminal: composes every window by z-order into one grid and emits a single diff per frame
+    private:
+        struct Layer
+        {
+            std::unique_ptr<Window> win;
+            int z;
+        };
+
+        int term_w, term_h;
+        detail::DamageGrid grid;          // the whole terminal, row 0 is terminal row 1
+        std::vector<uint16_t> owner;      // topmost layer index + 1 for each terminal cell, 0 for background
+        std::vector<Layer> layers;        // kept sorted by z, later entries are drawn on top
+        FrameEncoder out;
+        bool layout_stale = true;
+        bool synchronized = true;
+        ECHO_STAT(detail::StatCounters stats;)
+        Recorder *recorder = nullptr;
+        ColorMode color_mode = ColorMode::TrueColor;
+        bool parallel_encode = true;
+        ThreadPool *encode_pool = nullptr; // default_pool() when null
+
+        // held by layout changes and by the compose/encode step, never by producers drawing or publishing
+        std::mutex layout_lock;
+        std::thread render_thread;
+        std::atomic<bool> running{false};
+
+        Layer* find(const Window &win)
+        {
+            for (Layer &layer : layers)
+                if (layer.win.get() == &win)
+                    return &layer;
+            throw std::invalid_argument("\nERROR: Window does not belong to this Screen");
+        }
+
+        // rebuild the ownership map and recompose every cell, only cells that end up different get dirtied
+        void relayout()
+        {
+            std::stable_sort(layers.begin(), layers.end(), [](const Layer &a, const Layer &b) { return a.z < b.z; });
+            std::fill(owner.begin(), owner.end(), 0);
+
+            for (size_t k = 0; k < layers.size(); k++)
+            {
+                const Window &win = *layers[k].win;
+                int r0 = (std::max)(win.y - 1, 0), r1 = (std::min)(win.y - 1 + win.height, term_h);
+                int c0 = (std::max)(win.x - 1, 0), c1 = (std::min)(win.x - 1 + win.width, term_w);
+                for (int i = r0; i < r1; i++)
+                    std::fill(&owner[i * term_w + c0], &owner[i * term_w + c1], static_cast<uint16_t>(k + 1));
+            }
+
+            const Cell blank(' ', COLOR::RESET);
+            for (int i = 0; i < term_h; i++)
+            {
+                for (int j = 0; j < term_w; j++)
+                {
+                    uint16_t k = owner[i * term_w + j];
+                    if (!k)
+                    {
+                        grid.set(i, j, blank);
+                        continue;
+                    }
+                    const Window &win = *layers[k - 1].win;
+                    grid.set(i, j, win.frame_cell(j + 1 - win.x, i + 1 - win.y));
+                }
+            }
+
+            // the full recompose already picked up every window's damage, in threaded mode that belongs to the producer
+            for (Layer &layer : layers)
+            {
+                if (layer.win->publishing.load(std::memory_order_relaxed))
+                    continue;
+                detail::DamageGrid &damage = layer.win->grid;
+                std::fill(damage.dirty.begin(), damage.dirty.end(), 0);
+                std::fill(damage.row_dirty.begin(), damage.row_dirty.end(), 0);
+            }
+            layout_stale = false;
+        }
+
+        // copy one window's dirty cells into the terminal grid wherever that window is on top
+        void compose(size_t k)
+        {
+            Window &win = *layers[k].win;
+            detail::DamageGrid &damage = win.grid;
+            uint16_t id = static_cast<uint16_t>(k + 1);
+
+            for (int i = 0; i < damage.rows; i++)
+            {
+                if (!damage.row_dirty[i])
+                    continue;
+                int ty = win.y + i; // 0-based terminal row of window row i
+                const Cell *cells = damage.row(i);
+                damage.for_each_dirty(i, [&](int j) {
+                    int tx = win.x + j;
+                    if (ty < 0 || ty >= term_h || tx < 0 || tx >= term_w || owner[ty * term_w + tx] != id)
+                        return;
+                    if (cells[j].flags)
+                        set_half(ty, tx, cells[j], id);
+                    else
+                        grid.set(ty, tx, cells[j]);
+                });
+            }
+        }
+        // one half of a wide glyph: drawn whole when window `id` owns both columns, as a blank when the other is covered
+        void set_half(int ty, int tx, const Cell &cell, uint16_t id)
+        {
+            int partner = (cell.flags & Cell::Wide) ? tx + 1 : tx - 1;
+            if (partner < 0 || partner >= term_w || owner[ty * term_w + partner] != id)
+                grid.set(ty, tx, Cell(' ', cell.color));
+            else if (cell.flags & Cell::Wide)
+                grid.set(ty, tx, cell); // brings its continuation along
+        }
+
+        // threaded mode: diff the window's latest published frame against what is composed, a row at a time
+        void compose_published(size_t k)
+        {
+            Window &win = *layers[k].win;
+            const Cell *frame = win.published->read_buffer().data();
+            size_t stride = win.grid.stride;
+            uint16_t id = static_cast<uint16_t>(k + 1);
+
+            int r0 = (std::max)(-win.y, 0), r1 = (std::min)(win.grid.rows, term_h - win.y);
+            int c0 = (std::max)(-win.x, 0), c1 = (std::min)(win.grid.cols, term_w - win.x);
+            if (c0 >= c1)
+                return;
+
+            for (int i = r0; i < r1; i++)
+            {
+                int ty = win.y + i;
+                const Cell *src = frame + i * stride;
+                const Cell *dst = grid.row(ty) + win.x;
+                if (std::memcmp(src + c0, dst + c0, (c1 - c0) * sizeof(Cell)) == 0)
+                    continue;
+                for (int j = c0; j < c1; j++)
+                    if (owner[ty * term_w + win.x + j] == id)
+                    {
+                        if (src[j].flags)
+                            set_half(ty, win.x + j, src[j], id);
+                        else
+                            grid.set(ty, win.x + j, src[j]);
+                    }
+            }
+        }
+
+        void start_publishing(Window &win)
+        {
+            if (win.published)
+                win.published->reset(win.grid.back);
+            else
+                win.published = std::make_unique<detail::TripleBuffer<detail::aligned_vector<Cell>>>(win.grid.back);
+            win.publishing.store(true, std::memory_order_release);
+        }
+
+        // compose and encode under layout_lock, then write under screen_lock
+        void render_frame()
+        {
+            Recorder *target;
+            std::unique_lock<std::mutex> staged;
+            {
+                std::lock_guard<std::mutex> lock(layout_lock);
+                target = recorder;
+                if (target)
+                    out.tap = target->begin(staged);
+                bool threaded = running.load(std::memory_order_relaxed);
+
+                if (threaded)
+                {
+                    std::vector<bool> fresh(layers.size());
+                    for (size_t k = 0; k < layers.size(); k++)
+                        fresh[k] = layers[k].win->published->acquire();
+                    if (layout_stale)
+                        relayout();
+                    else
+                        for (size_t k = 0; k < layers.size(); k++)
+                            if (fresh[k])
+                                compose_published(k);
+                }
+                else if (layout_stale)
+                    relayout();
+                else
+                    for (size_t k = 0; k < layers.size(); k++)
+                        compose(k);
+
+                out.begin_frame();
+                if (synchronized)
+                    out.put("\033[?2026h");
+                size_t header = out.size();
+
+                ECHO_STAT(uint64_t encode_start = detail::now_ns();)
+                grid.encode(out, 1, 1, color_mode, parallel_encode, encode_pool);
+                ECHO_STAT(out.tally.encode_ns += detail::now_ns() - encode_start;)
+
+                if (out.size() == header)
+                {
+                    out.clear(); // nothing changed, keep the wire silent
+                    if (out.tap)
+                    {
+                        out.tap = nullptr;
+                        target->end(staged, false);
+                    }
+                    ECHO_STAT(record_frame();)
+                    return;
+                }
+                if (synchronized)
+                    out.put("\033[?2026l");
+                if (out.tap)
+                {
+                    out.tap = nullptr;
+                    target->end(staged);
+                }
+            }
+
+            ECHO_STAT(uint64_t wait_start = detail::now_ns();)
+            {
+                std::lock_guard<std::mutex> lock(screen_lock);
+                ECHO_STAT(out.tally.lock_wait_ns += detail::now_ns() - wait_start;)
+                out.flush();
+            }
+            ECHO_STAT(record_frame();)
+        }
+
+#if ECHO_ENABLE_STATS
+        void record_frame()
+        {
+            out.tally.frames = 1;
+            stats.add(out.tally);
+            detail::global_stats.add(out.tally);
+            out.tally = FrameStats();
+        }
+#endif
+
+    public:
+        // size defaults to whatever the sink reports, the current terminal for stdout
+        Screen(int cols = 0, int rows = 0, Sink &sink = default_sink())
+        {
+            out.set_sink(sink);
+            if (cols <= 0 || rows <= 0)
+                std::tie(cols, rows) = sink.size();
+            term_w = (std::max)(cols, 1);
+            term_h = (std::max)(rows, 1);
+
+            grid.resize(term_h, term_w);
+            owner.assign(term_w * term_h, 0);
+            out.set_right_edge(term_w);
+
+            // start from a known blank terminal so the front buffer is true from the first frame
+            out.put("\033[?25l\033[0m\033[2J");
+            std::lock_guard<std::mutex> lock(screen_lock);
+            out.flush();
+        }
+
+        ~Screen()
+        {
+            stop();
+            out.begin_frame();
+            out.move_to(1, term_h);
+            out.put("\033[0m\033[?25h\n");
+            std::lock_guard<std::mutex> lock(screen_lock);
+            out.flush();
+        }
+
+        Screen(const Screen&) = delete;
+        Screen& operator=(const Screen&) = delete;
+
+        // windows with a higher z are drawn over lower ones, equal z keeps insertion order
+        Window& add_window(int x, int y, int w, int h, std::string title = "", int z = 0)
+        {
+            std::lock_guard<std::mutex> lock(layout_lock);
+            if (layers.size() >= UINT16_MAX)
+                throw std::out_of_range("\nERROR: Too many windows on one Screen");
+            layers.push_back({std::unique_ptr<Window>(new Window(*this, x, y, w, h, std::move(title))), z});
+            if (running.load(std::memory_order_relaxed))
+                start_publishing(*layers.back().win);
+            layout_stale = true;
+            return *layers.back().win;
+        }
+
+        // the window must no longer be drawn into by any thread
+        void remove_window(Window &win)
+        {
+            std::lock_guard<std::mutex> lock(layout_lock);
+            Layer *layer = find(win);
+            layers.erase(layers.begin() + (layer - layers.data()));
+            layout_stale = true;
+        }
+
+        void set_z(Window &win, int z)
+        {
+            std::lock_guard<std::mutex> lock(layout_lock);
+            find(win)->z = z;
+            layout_stale = true;
+        }
+
+        void move_window(Window &win, int x, int y)
+        {
+            std::lock_guard<std::mutex> lock(layout_lock);
+            find(win);
+            win.x = x;
+            win.y = y;
+            layout_stale = true;
+        }
+
+        void set_color_mode(ColorMode mode)
+        {
+            std::lock_guard<std::mutex> lock(layout_lock);
+            color_mode = mode;
+        }
+
+        // as for a lone Window, applied to the whole composed terminal
+        void set_parallel_encoding(bool enabled, ThreadPool *pool = nullptr)
+        {
+            std::lock_guard<std::mutex> lock(layout_lock);
+            parallel_encode = enabled;
+            encode_pool = pool;
+        }
+
+        // record every frame from now on, starting with the whole terminal as it stands; nullptr stops
+        void record(Recorder *target)
+        {
+            std::lock_guard<std::mutex> lock(layout_lock);
+            recorder = target;
+            if (!target)
+                return;
+
+            std::unique_lock<std::mutex> staged;
+            if (detail::DamageTap *tap = target->begin(staged))
+            {
+                for (int i = 0; i < grid.rows; i++)
+                    for (int j = 0; j < grid.cols; j++)
+                        tap->add(j + 1, i + 1, grid.front[i * grid.stride + j]);
+                target->end(staged);
+            }
+        }
+
+        // what this screen has rendered so far, windows it composes included; all zero when stats are compiled out
+        FrameStats stats_snapshot() const
+        {
+#if ECHO_ENABLE_STATS
+            return stats.snapshot();
+#else
+            return FrameStats();
+#endif
+        }
+
+        // wrap frames in the synchronized-update escapes (mode 2026), terminals that lack it ignore them
+        void set_synchronized(bool enabled) { synchronized = enabled; }
+
+        // the terminal may no longer show what we think it does in this rectangle (1-based), resend it next frame
+        void invalidate(int x, int y, int w, int h)
+        {
+            std::lock_guard<std::mutex> lock(layout_lock);
+            const Cell unknown('\0');
+            for (int i = (std::max)(y - 1, 0); i < (std::min)(y - 1 + h, term_h); i++)
+                for (int j = (std::max)(x - 1, 0); j < (std::min)(x - 1 + w, term_w); j++)
+                    grid.assume_front(i, j, unknown);
+        }
+        void invalidate() { invalidate(1, 1, term_w, term_h); }
+
+        // with a render thread running this does nothing, that thread emits frames on its own cadence
+        void render()
+        {
+            if (running.load(std::memory_order_relaxed))
+                return;
+            render_frame();
+        }
+
+        // opt-in threaded mode: Window::render() only publishes, and one thread composes and writes every period.
+        // start it before any producer begins drawing, each window should be drawn by a single thread
+        void start(std::chrono::nanoseconds period)
+        {
+            if (running.load())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(layout_lock);
+                for (Layer &layer : layers)
+                    start_publishing(*layer.win);
+                layout_stale = true;
+                running.store(true);
+            }
+
+            render_thread = std::thread([this, period] {
+                auto next = steady_clock::now();
+                while (running.load(std::memory_order_acquire))
+                {
+                    render_frame();
+                    next += period;
+                    auto now = steady_clock::now();
+                    if (next < now)
+                    {
+                        ECHO_STAT(uint64_t missed = static_cast<uint64_t>((now - next) / period); stats.drop(missed); detail::global_stats.drop(missed);)
+                        next = now; // fell behind, drop the missed ticks rather than bursting
+                    }
+                    std::this_thread::sleep_until(next);
+                }
+            });
+        }
+
+        // joins the render thread, windows go back to being composed by render()
+        void stop()
+        {
+            if (!running.exchange(false))
+                return;
+            render_thread.join();
+
+            std::lock_guard<std::mutex> lock(layout_lock);
+            for (Layer &layer : layers)
+            {
+                // recompose from the live buffers next frame; the buffers stay, a producer may still be publishing
+                layer.win->publishing.store(false, std::memory_order_release);
+            }
+            layout_stale = true;
+        }
+
+        int get_w() const { return term_w; }
+        int get_h() const { return term_h; }
+    };
+
+    inline void Window::clear_inside()
+    {
+        if (screen)
+        {
+            screen->invalidate(x + 1, y + 1, width - 2, height - 2);
+            return;
+        }
+
+        std::unique_lock<std::mutex> staged;
+        detail::DamageTap *tap = recorder ? recorder->begin(staged) : nullptr;
+        for (int i = 1; i < height - 1; i++)
+        {
+            out.move_to(x + 1, y + i);
+            out.put(' ', width - 2);
+            if (tap)
+                for (int j = 1; j < width - 1; j++)
+                    tap->add(x + j, y + i, Cell());
+        }
+        if (tap)
+            recorder->end(staged);
+        {
+            std::lock_guard<std::mutex> lock(screen_lock);
+            out.flush();
+        }
+
+        // the terminal is blank now, so anything with ink has to go out again
+        const Cell blank(' ', COLOR::RESET);
+        for (int i = 0; i < grid.rows; i++)
+            for (int j = 0; j < grid.cols; j++)
+                grid.assume_front(i, j, blank);
+    }
+
+    class Canvas
+    { // sub-cell pixels on top of a Window: 2x4 per cell with Braille, 1x2 with half blocks
+    public:
+        enum class Mode { Braille, HalfBlock };
+
+    private:
+        Window &win;
+        Mode mode;
+        int cell_w, cell_h;          // pixels per cell
+        int px_w, px_h;              // canvas size in pixels
+        size_t words_per_row;
+        std::vector<uint64_t> bits;  // one bit per pixel, 64 to a word, row-major
+        std::vector<COLOR> colors;   // per cell, the last colour drawn into it
+        COLOR pen;
+
+        uint64_t* row_bits(int py) { return &bits[py * words_per_row]; }
+
+        void tint(int px, int py)
+        {
+            colors[(py / cell_h) * win.get_w() + px / cell_w] = pen;
+        }
+
+    public:
+        Canvas(Window &win, Mode mode = Mode::Braille, const COLOR &color = COLOR(COLOR::RESET))
+            : win(win), mode(mode), pen(color)
+        {
+            cell_w = mode == Mode::Braille ? 2 : 1;
+            cell_h = mode == Mode::Braille ? 4 : 2;
+            px_w = win.get_w() * cell_w;
+            px_h = win.get_h() * cell_h;
+            words_per_row = (px_w + 63) / 64;
+            bits.assign(words_per_row * px_h, 0);
+            colors.assign(win.get_w() * win.get_h(), color);
+        }
+
+        int width() const { return px_w; }
+        int height() const { return px_h; }
+
+        void set_color(const COLOR &color) { pen = color; }
+
+        void clear()
+        {
+            std::fill(bits.begin(), bits.end(), 0);
+        }
+
+        // ----------------- PIXELS -----------------
+        void set(int px, int py)
+        {
+            if (px < 0 || px >= px_w || py < 0 || py >= px_h)
+                return;
+            row_bits(py)[px >> 6] |= uint64_t(1) << (px & 63);
+            tint(px, py);
+        }
+
+        void unset(int px, int py)
+        {
+            if (px < 0 || px >= px_w || py < 0 || py >= px_h)
+                return;
+            row_bits(py)[px >> 6] &= ~(uint64_t(1) << (px & 63));
+        }
+
+        bool get(int px, int py) const
+        {
+            if (px < 0 || px >= px_w || py < 0 || py >= px_h)
+                return false;
+            return bits[py * words_per_row + (px >> 6)] >> (px & 63) & 1;
+        }
+
+        // pixels [x0, x1] on row py, whole words at a time
+        void hline(int x0, int x1, int py)
+        {
+            if (x0 > x1) std::swap(x0, x1);
+            if (py < 0 || py >= px_h || x1 < 0 || x0 >= px_w)
+                return;
+            x0 = (std::max)(x0, 0);
+            x1 = (std::min)(x1, px_w - 1);
+
+            uint64_t *row = row_bits(py);
+            size_t w0 = x0 >> 6, w1 = x1 >> 6;
+            uint64_t head = ~uint64_t(0) << (x0 & 63);
+            uint64_t tail = ~uint64_t(0) >> (63 - (x1 & 63));
+            if (w0 == w1)
+                row[w0] |= head & tail;
+            else
+            {
+                row[w0] |= head;
+                for (size_t w = w0 + 1; w < w1; w++)
+                    row[w] = ~uint64_t(0);
+                row[w1] |= tail;
+            }
+
+            int c0 = x0 / cell_w, c1 = x1 / cell_w;
+            std::fill(&colors[(py / cell_h) * win.get_w() + c0], &colors[(py / cell_h) * win.get_w() + c1] + 1, pen);
+        }
+
+        void vline(int px, int y0, int y1)
+        {
+            if (y0 > y1) std::swap(y0, y1);
+            if (px < 0 || px >= px_w)
+                return;
+            uint64_t bit = uint64_t(1) << (px & 63);
+            for (int py = (std::max)(y0, 0); py <= (std::min)(y1, px_h - 1); py++)
+            {
+                row_bits(py)[px >> 6] |= bit;
+                tint(px, py);
+            }
+        }
+
+        // Bresenham, with each horizontal stretch of a shallow line set as one span
+        void line(int x0, int y0, int x1, int y1)
+        {
+            if (y0 == y1) { hline(x0, x1, y0); return; }
+            if (x0 == x1) { vline(x0, y0, y1); return; }
+
+            int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+            int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+            int err = dx + dy;
+            int run_start = x0;
+
+            while (true)
+            {
+                if (x0 == x1 && y0 == y1) { hline(run_start, x0, y0); break; }
+                int e2 = 2 * err;
+                if (e2 >= dy) { err += dy; x0 += sx; }
+                if (e2 <= dx)
+                {
+                    hline(run_start, x0 - (e2 >= dy ? sx : 0), y0);
+                    err += dx;
+                    y0 += sy;
+                    run_start = x0;
+                }
+            }
+        }
+
+        void rect(int x, int y, int w, int h, bool filled = false)
+        {
+            if (w <= 0 || h <= 0)
+                return;
+            if (filled)
+            {
+                for (int py = y; py < y + h; py++)
+                    hline(x, x + w - 1, py);
+                return;
+            }
+            hline(x, x + w - 1, y);
+            hline(x, x + w - 1, y + h - 1);
+            vline(x, y, y + h - 1);
+            vline(x + w - 1, y, y + h - 1);
+        }
+
+        // turn the pixels into glyphs; only cells whose glyph or colour changed get dirtied
+        void flush()
+        {
+            int cols = win.get_w(), rows = win.get_h();
+
+            if (mode == Mode::Braille)
+            {
+                // dot bit for (column within cell, row within cell), per the Unicode Braille layout
+                static constexpr uint8_t dot[2][4] = {{0x01, 0x02, 0x04, 0x40}, {0x08, 0x10, 0x20, 0x80}};
+
+                for (int cy = 0; cy < rows; cy++)
+                {
+                    const uint64_t *r[4];
+                    for (int k = 0; k < 4; k++)
+                        r[k] = &bits[(cy * 4 + k) * words_per_row];
+
+                    for (size_t w = 0; w < words_per_row; w++)
+                    {
+                        uint64_t any = r[0][w] | r[1][w] | r[2][w] | r[3][w];
+                        int first = static_cast<int>(w * 32), last = (std::min)(first + 32, cols);
+                        for (int cx = first; cx < last; cx++)
+                        {
+                            unsigned pattern = 0;
+                            if (any)
+                            {
+                                int shift = (cx - first) * 2;
+                                for (int k = 0; k < 4; k++)
+                                {
+                                    unsigned pair = static_cast<unsigned>(r[k][w] >> shift) & 3;
+                                    pattern |= (pair & 1 ? dot[0][k] : 0) | (pair & 2 ? dot[1][k] : 0);
+                                }
+                            }
+                            win.set_cell(cy, cx, pattern ? char32_t(0x2800 + pattern) : U' ', colors[cy * cols + cx]);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                for (int cy = 0; cy < rows; cy++)
+                {
+                    const uint64_t *top = &bits[(cy * 2) * words_per_row];
+                    const uint64_t *bottom = &bits[(cy * 2 + 1) * words_per_row];
+                    for (int cx = 0; cx < cols; cx++)
+                    {
+                        bool t = top[cx >> 6] >> (cx & 63) & 1, b = bottom[cx >> 6] >> (cx & 63) & 1;
+                        char32_t ch = t && b ? U'\u2588' : t ? U'\u2580' : b ? U'\u2584' : U' ';
+                        win.set_cell(cy, cx, ch, colors[cy * cols + cx]);
+                    }
+                }
+            }
+        }
+    };
+
+    class Chart
+    { // a live series: lock-free O(1) push from any thread, drawn into a window region by whoever renders that window
+    public:
+        enum class Style { Bars, Sparkline, Line };
+        enum class Reduce { Mean, Min, Max }; // what a column shows when it covers several samples
+
+    private:
+        struct Bucket
+        {
+            int64_t index = -1; // which run of per_column samples this is, -1 when unused
+            float min = 0.0f, max = 0.0f;
+            double sum = 0.0;
+            uint32_t count = 0;
+        };
+
+        Window &win;
+        int row, col, w, h;
+        Style style;
+        Reduce reduce;
+        COLOR color;
+
+        // sample i lives in slots[i & mask] as (low 32 bits of i) << 32 | float bits, so a reader can tell
+        // a slot that was written for i from one that is still pending or already reused
+        std::unique_ptr<std::atomic<uint64_t>[]> slots;
+        uint64_t mask;
+        alignas(detail::cache_line) std::atomic<uint64_t> head{0};
+
+        // reader side, only touched by draw()
+        uint64_t consumed = 0;
+        uint64_t per_column;           // samples folded into one column
+        std::vector<Bucket> buckets;   // the last w + 1 columns, keyed by index % size; finished ones never change
+        std::vector<uint32_t> drawn;   // what each column currently shows, so unchanged columns are skipped
+        bool fixed_range = false;
+        float lo = 0.0f, hi = 1.0f;
+
+        static constexpr uint64_t unwritten = uint64_t(UINT32_MAX) << 32;
+
+        Bucket *bucket(int64_t index)
+        {
+            Bucket &b = buckets[index % buckets.size()];
+            return b.index == index ? &b : nullptr;
+        }
+
+        float value(const Bucket &b) const
+        {
+            switch (reduce)
+            {
+            case Reduce::Min: return b.min;
+            case Reduce::Max: return b.max;
+            default:          return static_cast<float>(b.sum / b.count);
+            }
+        }
+
+        // fold every sample published since the last draw into its bucket
+        void consume()
+        {
+            uint64_t end = head.load(std::memory_order_acquire);
+            if (end - consumed > mask + 1)
+                consumed = end - (mask + 1); // fell a whole ring behind, those samples are gone
+            for (; consumed < end; consumed++)
+            {
+                uint64_t word = slots[consumed & mask].load(std::memory_order_acquire);
+                if ((word >> 32) != (consumed & UINT32_MAX))
+                    break; // claimed but not stored yet, pick it up next time
+                float v = std::bit_cast<float>(static_cast<uint32_t>(word));
+
+                int64_t index = static_cast<int64_t>(consumed / per_column);
+                Bucket &b = buckets[index % buckets.size()];
+                if (b.index != index)
+                    b = Bucket{index, v, v, 0.0, 0};
+                b.min = (std::min)(b.min, v);
+                b.max = (std::max)(b.max, v);
+                b.sum += v;
+                b.count++;
+            }
+        }
+
+        // value -> distance from the top of the region, in eighths of a cell
+        int eighths(float v) const
+        {
+            float t = std::clamp((v - lo) / (hi - lo), 0.0f, 1.0f);
+            return static_cast<int>(std::lround(t * (h * 8)));
+        }
+        int line_row(float v) const
+        {
+            float t = std::clamp((hi - v) / (hi - lo), 0.0f, 1.0f);
+            return static_cast<int>(std::lround(t * (h - 1)));
+        }
+
+        void draw_column(int j, uint32_t sig)
+        {
+            int cx = col + j;
+            if (style == Style::Line)
+            {
+                // sig packs the covered rows as top << 16 | bottom, 0 for an empty column
+                int top = sig ? static_cast<int>(sig >> 16) - 1 : h, bottom = sig ? static_cast<int>(sig & 0xffff) - 1 : -1;
+                for (int r = 0; r < h; r++)
+                {
+                    char32_t ch = r < top || r > bottom ? U' ' : top == bottom ? U'─' : U'│';
+                    win.set_cell(row + r, cx, ch, color);
+                }
+                return;
+            }
+
+            // bars and sparklines: sig is the height in eighths, the top cell gets a partial block U+2581..U+2588
+            int height = static_cast<int>(sig);
+            for (int k = 0; k < h; k++)
+            {
+                int fill = std::clamp(height - k * 8, 0, 8);
+                win.set_cell(row + h - 1 - k, cx, fill ? char32_t(0x2580 + fill) : U' ', color);
+            }
+        }
+
+    public:
+        // the region (row, col, width, height) is in window cells; `capacity` is how many samples the chart spans,
+        // folded min/mean/max into columns when there are more than the region is wide (0 means one per column)
+        Chart(Window &win, int row, int col, int width, int height, Style style = Style::Sparkline, size_t capacity = 0,
+              const COLOR &color = COLOR(COLOR::RESET), Reduce reduce = Reduce::Mean)
+            : win(win), row(row), col(col), w(width), h(style == Style::Sparkline ? 1 : height), style(style), reduce(reduce), color(color)
+        {
+            if (width <= 0 || height <= 0 || row < 0 || col < 0 || col + width > win.get_w() || row + height > win.get_h())
+                throw std::out_of_range("\nERROR: Chart region exceeds window bounds");
+            if (style == Style::Sparkline)
+                this->row = row + height - 1; // one row, along the bottom of the region
+
+            if (capacity == 0)
+                capacity = w;
+            per_column = (capacity + w - 1) / w;
+            uint64_t ring = std::bit_ceil(static_cast<uint64_t>(capacity));
+            mask = ring - 1;
+            slots.reset(new std::atomic<uint64_t>[ring]);
+            for (uint64_t i = 0; i < ring; i++)
+                slots[i].store(unwritten, std::memory_order_relaxed);
+
+            buckets.assign(w + 1, Bucket());
+            drawn.assign(w, UINT32_MAX);
+        }
+        Chart(Window &win, Style style = Style::Sparkline, size_t capacity = 0, const COLOR &color = COLOR(COLOR::RESET), Reduce reduce = Reduce::Mean)
+            : Chart(win, 0, 0, win.get_w(), win.get_h(), style, capacity, color, reduce) {}
+
+        // any thread, never blocks and never touches the window
+        void push(float v)
+        {
+            uint64_t i = head.fetch_add(1, std::memory_order_relaxed);
+            slots[i & mask].store((i << 32) | std::bit_cast<uint32_t>(v), std::memory_order_release);
+        }
+
+        // pin the vertical scale, otherwise it follows what is on screen
+        void set_range(float low, float high)
+        {
+            if (!(high > low))
+                throw std::invalid_argument("\nERROR: Chart range needs high > low");
+            lo = low;
+            hi = high;
+            fixed_range = true;
+        }
+        void auto_range() { fixed_range = false; }
+
+        void set_color(const COLOR &c)
+        {
+            color = c;
+            std::fill(drawn.begin(), drawn.end(), UINT32_MAX);
+        }
+
+        // fold in new samples and rewrite the columns whose picture changed; call from the thread that renders `win`
+        void draw()
+        {
+            consume();
+            if (consumed == 0)
+                return;
+            int64_t newest = static_cast<int64_t>((consumed - 1) / per_column);
+            auto column = [&](int j) { return bucket(newest - (w - 1 - j)); }; // newest bucket on the right
+
+            if (!fixed_range)
+            {
+                float low = std::numeric_limits<float>::infinity(), high = -low;
+                for (int j = 0; j < w; j++)
+                    if (const Bucket *b = column(j))
+                    {
+                        low = (std::min)(low, style == Style::Line ? b->min : value(*b));
+                        high = (std::max)(high, style == Style::Line ? b->max : value(*b));
+                    }
+                if (!(high > low))
+                    high = low + 1.0f;
+                lo = low;
+                hi = high;
+            }
+
+            int prev_top = -1, prev_bottom = -1;
+            for (int j = 0; j < w; j++)
+            {
+                const Bucket *b = column(j);
+                uint32_t sig = 0;
+                if (b && style == Style::Line)
+                {
+                    // the column covers its own min..max, stretched to meet the previous one so the line stays joined
+                    int top = line_row(b->max), bottom = line_row(b->min);
+                    int own_top = top, own_bottom = bottom;
+                    if (prev_top >= 0)
+                    {
+                        if (prev_bottom < top - 1) top = prev_bottom + 1;
+                        if (prev_top > bottom + 1) bottom = prev_top - 1;
+                    }
+                    prev_top = own_top;
+                    prev_bottom = own_bottom;
+                    sig = static_cast<uint32_t>(top + 1) << 16 | static_cast<uint32_t>(bottom + 1);
+                }
+                else if (b)
+                {
+                    sig = static_cast<uint32_t>(eighths(value(*b)));
+                    if (style == Style::Sparkline)
+                        sig = std::clamp<uint32_t>(sig, 1, 8); // the lowest value still shows
+                }
+                else
+                {
+                    prev_top = prev_bottom = -1;
+                }
+
+                if (sig != drawn[j])
+                {
+                    draw_column(j, sig);
+                    drawn[j] = sig;
+                }
+            }
+        }
+    };
+
+    namespace ThreeD {
+            struct Point2D {
+                int x, y;
+                Point2D(int x=0, int y=0) : x(x), y(y) {}
+            };
+
+            struct Point3D {
+                float x, y, z;
+                Point3D(float x=0, float y=0, float z=0) : x(x), y(y), z(z) {}
+
+                // single points only, whole meshes should go through a Mat4 and transform()/project()
+                Point3D rotate(float angle) const {
+                    float rad = angle * 0.0174533f; // Convert degrees to radians
+                    float c = std::cos(rad), s = std::sin(rad);
+                    
+                    // Rotate around Y-axis
+                    float nx = x * c - z * s;
+                    float nz = x * s + z * c;
+                    
+                    // Rotate around X-axis
+                    float ny = y * c - nz * s;
+                    nz = y * s + nz * c;
+                    
+                    return Point3D(nx, ny, nz);
+                }
+
+                // for casting 3D to 2D
+                operator Point2D() const {
+                    return Point2D(x, y);
+                }
+            };
+
+            // 4x4 affine/projective transform acting on column vectors, so (A * B) applies B first
+            struct Mat4 {
+                float m[4][4];
+
+                static Mat4 identity() {
+                    Mat4 r{};
+                    r.m[0][0] = r.m[1][1] = r.m[2][2] = r.m[3][3] = 1.0f;
+                    return r;
+                }
+
+                // same handedness as Point3D::rotate, so rotate_x(a) * rotate_y(a) matches rotate(a)
+                static Mat4 rotate_x(float degrees) {
+                    float rad = degrees * 0.0174533f, c = std::cos(rad), s = std::sin(rad);
+                    Mat4 r = identity();
+                    r.m[1][1] = c; r.m[1][2] = -s;
+                    r.m[2][1] = s; r.m[2][2] = c;
+                    return r;
+                }
+
+                static Mat4 rotate_y(float degrees) {
+                    float rad = degrees * 0.0174533f, c = std::cos(rad), s = std::sin(rad);
+                    Mat4 r = identity();
+                    r.m[0][0] = c; r.m[0][2] = -s;
+                    r.m[2][0] = s; r.m[2][2] = c;
+                    return r;
+                }
+
+                static Mat4 rotate_z(float degrees) {
+                    float rad = degrees * 0.0174533f, c = std::cos(rad), s = std::sin(rad);
+                    Mat4 r = identity();
+                    r.m[0][0] = c; r.m[0][1] = -s;
+                    r.m[1][0] = s; r.m[1][1] = c;
+                    return r;
+                }
+
+                static Mat4 scale(float sx, float sy, float sz) {
+                    Mat4 r = identity();
+                    r.m[0][0] = sx; r.m[1][1] = sy; r.m[2][2] = sz;
+                    return r;
+                }
+                static Mat4 scale(float s) { return scale(s, s, s); }
+
+                static Mat4 translate(float tx, float ty, float tz) {
+                    Mat4 r = identity();
+                    r.m[0][3] = tx; r.m[1][3] = ty; r.m[2][3] = tz;
+                    return r;
+                }
+
+                // camera at `eye` looking at `target`, the result takes world space into view space
+                // view space matches the terminal: +x right, +y down, +z into the screen
+                static Mat4 look_at(const Point3D &eye, const Point3D &target, const Point3D &down = Point3D(0, 1, 0)) {
+                    auto normalize = [](float &x, float &y, float &z) {
+                        float len = std::sqrt(x * x + y * y + z * z);
+                        if (len > 0) { x /= len; y /= len; z /= len; }
+                    };
+                    float fx = target.x - eye.x, fy = target.y - eye.y, fz = target.z - eye.z;
+                    normalize(fx, fy, fz);
+                    float rx = down.y * fz - down.z * fy, ry = down.z * fx - down.x * fz, rz = down.x * fy - down.y * fx; // down x forward
+                    normalize(rx, ry, rz);
+                    float ux = fy * rz - fz * ry, uy = fz * rx - fx * rz, uz = fx * ry - fy * rx;                   // forward x right
+
+                    Mat4 r = identity();
+                    r.m[0][0] = rx; r.m[0][1] = ry; r.m[0][2] = rz; r.m[0][3] = -(rx * eye.x + ry * eye.y + rz * eye.z);
+                    r.m[1][0] = ux; r.m[1][1] = uy; r.m[1][2] = uz; r.m[1][3] = -(ux * eye.x + uy * eye.y + uz * eye.z);
+                    r.m[2][0] = fx; r.m[2][1] = fy; r.m[2][2] = fz; r.m[2][3] = -(fx * eye.x + fy * eye.y + fz * eye.z);
+                    return r;
+                }
+
+                // maps x/y onto window cells around (center_x, center_y), terminal cells are about twice as tall as wide
+                static Mat4 viewport(float center_x, float center_y, float scale_x = 2.0f, float scale_y = 1.0f) {
+                    Mat4 r = identity();
+                    r.m[0][0] = scale_x; r.m[0][3] = center_x;
+                    r.m[1][1] = scale_y; r.m[1][3] = center_y;
+                    return r;
+                }
+
+                Mat4 operator*(const Mat4 &o) const {
+                    Mat4 r{};
+                    for (int i = 0; i < 4; i++)
+                        for (int j = 0; j < 4; j++)
+                            r.m[i][j] = m[i][0] * o.m[0][j] + m[i][1] * o.m[1][j] + m[i][2] * o.m[2][j] + m[i][3] * o.m[3][j];
+                    return r;
+                }
+
+                Point3D operator*(const Point3D &p) const {
+                    return Point3D(
+                        m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                        m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                        m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]
+                    );
+                }
+            };
+
+            // structure-of-arrays vertices, each kernel streams through one contiguous array per coordinate
+            struct VertexBatch {
+                std::vector<float> x, y, z;
+
+                VertexBatch() = default;
+                VertexBatch(const std::vector<Point3D> &points) {
+                    reserve(points.size());
+                    for (const Point3D &p : points)
+                        push_back(p);
+                }
+
+                size_t size() const { return x.size(); }
+                void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+                void reserve(size_t n) { x.reserve(n); y.reserve(n); z.reserve(n); }
+                void push_back(const Point3D &p) { x.push_back(p.x); y.push_back(p.y); z.push_back(p.z); }
+                Point3D operator[](size_t i) const { return Point3D(x[i], y[i], z[i]); }
+            };
+
+            // window cell coordinates plus the depth each vertex had before projection
+            struct ProjectedBatch {
+                std::vector<int> x, y;
+                std::vector<float> depth;
+
+                size_t size() const { return x.size(); }
+                void resize(size_t n) { x.resize(n); y.resize(n); depth.resize(n); }
+                Point2D operator[](size_t i) const { return Point2D(x[i], y[i]); }
+            };
+
+            // out = m * in for every vertex; out keeps its capacity, so reusing it across frames allocates nothing
+            inline void transform(const Mat4 &mat, const VertexBatch &in, VertexBatch &out) {
+                size_t n = in.size();
+                out.resize(n);
+
+                const float *__restrict ix = in.x.data(), *__restrict iy = in.y.data(), *__restrict iz = in.z.data();
+                float *__restrict ox = out.x.data(), *__restrict oy = out.y.data(), *__restrict oz = out.z.data();
+                const float (&m)[4][4] = mat.m;
+                const float m00 = m[0][0], m01 = m[0][1], m02 = m[0][2], m03 = m[0][3];
+                const float m10 = m[1][0], m11 = m[1][1], m12 = m[1][2], m13 = m[1][3];
+                const float m20 = m[2][0], m21 = m[2][1], m22 = m[2][2], m23 = m[2][3];
+
+                // straight-line body with no aliasing, so the compiler vectorises it
+                for (size_t i = 0; i < n; i++) {
+                    float px = ix[i], py = iy[i], pz = iz[i];
+                    ox[i] = m00 * px + m01 * py + m02 * pz + m03;
+                    oy[i] = m10 * px + m11 * py + m12 * pz + m13;
+                    oz[i] = m20 * px + m21 * py + m22 * pz + m23;
+                }
+            }
+
+            // view = model/camera transform, screen = e.g. Mat4::viewport; depth is the view-space z
+            inline void project(const Mat4 &view, const Mat4 &screen, const VertexBatch &in, ProjectedBatch &out) {
+                size_t n = in.size();
+                out.resize(n);
+
+                Mat4 full = screen * view;
+                const float *__restrict ix = in.x.data(), *__restrict iy = in.y.data(), *__restrict iz = in.z.data();
+                int *__restrict ox = out.x.data(), *__restrict oy = out.y.data();
+                float *__restrict od = out.depth.data();
+                const float (&m)[4][4] = full.m;
+                const float m00 = m[0][0], m01 = m[0][1], m02 = m[0][2], m03 = m[0][3];
+                const float m10 = m[1][0], m11 = m[1][1], m12 = m[1][2], m13 = m[1][3];
+                const float m20 = m[2][0], m21 = m[2][1], m22 = m[2][2], m23 = m[2][3];
+
+                for (size_t i = 0; i < n; i++) {
+                    float px = ix[i], py = iy[i], pz = iz[i];
+                    ox[i] = static_cast<int>(m00 * px + m01 * py + m02 * pz + m03);
+                    oy[i] = static_cast<int>(m10 * px + m11 * py + m12 * pz + m13);
+                    od[i] = m20 * px + m21 * py + m22 * pz + m23;
+                }
+            }
+
+            // pinhole camera, view space looks down +z; points nearer than near_plane are clipped away
+            struct Camera {
+                Mat4 view = Mat4::identity();
+                float fov = 60.0f;          // vertical, in degrees
+                float near_plane = 0.1f;
+                float far_plane = 1000.0f;
+                float cell_aspect = 2.0f;   // terminal cells are about twice as tall as wide
+
+                Camera() = default;
+                Camera(const Point3D &eye, const Point3D &target, float fov = 60.0f) : view(Mat4::look_at(eye, target)), fov(fov) {}
+
+                float focal(int win_h) const { return 0.5f * win_h / std::tan(fov * 0.5f * 0.0174533f); }
+
+                // view-space point to fractional window coordinates, z passes through as the depth
+                Point3D to_window(const Point3D &v, int win_w, int win_h) const {
+                    float f = focal(win_h) / v.z;
+                    return Point3D(0.5f * win_w + v.x * f * cell_aspect, 0.5f * win_h + v.y * f, v.z);
+                }
+            };
+
+            // perspective version of project(): depth < cam.near_plane marks a vertex behind the camera, its x/y are meaningless
+            inline void project(const Camera &cam, const Mat4 &model, const VertexBatch &in, ProjectedBatch &out, int win_w, int win_h) {
+                size_t n = in.size();
+                out.resize(n);
+
+                Mat4 full = cam.view * model;
+                const float *__restrict ix = in.x.data(), *__restrict iy = in.y.data(), *__restrict iz = in.z.data();
+                int *__restrict ox = out.x.data(), *__restrict oy = out.y.data();
+                float *__restrict od = out.depth.data();
+                const float (&m)[4][4] = full.m;
+                const float m00 = m[0][0], m01 = m[0][1], m02 = m[0][2], m03 = m[0][3];
+                const float m10 = m[1][0], m11 = m[1][1], m12 = m[1][2], m13 = m[1][3];
+                const float m20 = m[2][0], m21 = m[2][1], m22 = m[2][2], m23 = m[2][3];
+                const float f = cam.focal(win_h), fx = f * cam.cell_aspect, half_w = 0.5f * win_w, half_h = 0.5f * win_h;
+                const float near_plane = cam.near_plane;
+
+                for (size_t i = 0; i < n; i++) {
+                    float px = ix[i], py = iy[i], pz = iz[i];
+                    float vx = m00 * px + m01 * py + m02 * pz + m03;
+                    float vy = m10 * px + m11 * py + m12 * pz + m13;
+                    float vz = m20 * px + m21 * py + m22 * pz + m23;
+                    float inv = 1.0f / (std::max)(vz, near_plane);
+                    ox[i] = static_cast<int>(std::floor(half_w + vx * fx * inv));
+                    oy[i] = static_cast<int>(std::floor(half_h + vy * f * inv));
+                    od[i] = vz;
+                }
+            }
+
+            // cut a view-space segment down to near_plane <= z <= far_plane, false when nothing is left
+            inline bool clip_depth(const Camera &cam, Point3D &a, Point3D &b) {
+                auto clip = [](Point3D &inside, Point3D &outside, float plane) {
+                    float t = (plane - inside.z) / (outside.z - inside.z);
+                    outside = Point3D(inside.x + t * (outside.x - inside.x), inside.y + t * (outside.y - inside.y), plane);
+                };
+                if (a.z < cam.near_plane && b.z < cam.near_plane) return false;
+                if (a.z > cam.far_plane && b.z > cam.far_plane) return false;
+                if (a.z < cam.near_plane) clip(b, a, cam.near_plane);
+                else if (b.z < cam.near_plane) clip(a, b, cam.near_plane);
+                if (a.z > cam.far_plane) clip(b, a, cam.far_plane);
+                else if (b.z > cam.far_plane) clip(a, b, cam.far_plane);
+                return true;
+            }
+    }
+
+    namespace detail {
+        // a line walked along its major axis: step i sits at major + i, minor + round(i * m / M) (halves round up),
+        // which is exactly the pixel Bresenham picks there, so a clipped walk lands on the same cells as a full one
+        struct LineWalk {
+            int x0 = 0, y0 = 0, sx = 1, sy = 1;
+            int64_t major = 0, minor = 0; // |d| along the long and short axis
+            bool x_major = true;
+            int64_t first = 0, last = -1; // steps that fall inside the clip box, empty when first > last
+        };
+
+        inline int64_t floor_div(int64_t a, int64_t b) { return a / b - ((a % b != 0) && ((a < 0) != (b < 0))); }
+        inline int64_t ceil_div(int64_t a, int64_t b) { return -floor_div(-a, b); }
+
+        // Liang-Barsky on the step index: each window edge trims [first, last] from one side
+        inline LineWalk clip_line(int x0, int y0, int x1, int y1, int w, int h)
+        {
+            LineWalk l;
+            l.x0 = x0; l.y0 = y0;
+            l.sx = x0 < x1 ? 1 : -1;
+            l.sy = y0 < y1 ? 1 : -1;
+            int64_t dx = std::abs(int64_t(x1) - x0), dy = std::abs(int64_t(y1) - y0);
+            l.x_major = dx >= dy;
+            l.major = l.x_major ? dx : dy;
+            l.minor = l.x_major ? dy : dx;
+            if (w <= 0 || h <= 0)
+                return l;
+
+            int64_t M = l.major, m = l.minor;
+            int64_t maj0 = l.x_major ? x0 : y0, min0 = l.x_major ? y0 : x0;
+            int smaj = l.x_major ? l.sx : l.sy, smin = l.x_major ? l.sy : l.sx;
+            int64_t maj_size = l.x_major ? w : h, min_size = l.x_major ? h : w;
+
+            // major coordinate maj0 + smaj * i must land in [0, maj_size)
+            int64_t lo = 0, hi = M;
+            if (smaj > 0) { lo = (std::max)(lo, -maj0); hi = (std::min)(hi, maj_size - 1 - maj0); }
+            else          { lo = (std::max)(lo, maj0 - (maj_size - 1)); hi = (std::min)(hi, maj0); }
+
+            // minor offset j(i) = floor((2im + M) / 2M) must keep min0 + smin * j in [0, min_size)
+            int64_t j_lo = smin > 0 ? -min0 : min0 - (min_size - 1);
+            int64_t j_hi = smin > 0 ? min_size - 1 - min0 : min0;
+            if (m == 0)
+            {
+                if (j_lo > 0 || j_hi < 0)
+                    return l;
+            }
+            else
+            {
+                // j(i) >= a  <=>  i >= ceil((2aM - M) / 2m);  j(i) <= b  <=>  i <= floor((2(b+1)M - M - 1) / 2m)
+                lo = (std::max)(lo, ceil_div(2 * j_lo * M - M, 2 * m));
+                hi = (std::min)(hi, floor_div(2 * (j_hi + 1) * M - M - 1, 2 * m));
+            }
+            l.first = lo;
+            l.last = hi;
+            return l;
+        }
+
+        // plot(x, y) for every step of `l` between first and last, in order
+        template <typename Plot>
+        inline void walk_line(const LineWalk &l, Plot &&plot)
+        {
+            if (l.first > l.last)
+                return;
+
+            int64_t M2 = 2 * l.major, m2 = 2 * l.minor;
+            int64_t num = l.first * m2 + l.major; // j = num / M2, kept as quotient + remainder
+            int64_t j = l.major == 0 ? 0 : num / M2;
+            int64_t rem = l.major == 0 ? 0 : num - j * M2;
+
+            int x = l.x0, y = l.y0;
+            if (l.x_major) { x += static_cast<int>(l.sx * l.first); y += static_cast<int>(l.sy * j); }
+            else           { y += static_cast<int>(l.sy * l.first); x += static_cast<int>(l.sx * j); }
+
+            for (int64_t i = l.first; i <= l.last; i++)
+            {
+                plot(x, y);
+                rem += m2;
+                bool carry = rem >= M2;
+                if (carry) rem -= M2;
+                if (l.x_major) { x += l.sx; if (carry) y += l.sy; }
+                else           { y += l.sy; if (carry) x += l.sx; }
+            }
+        }
+    }
+
+    namespace Visualizer
+    {
+        namespace Primitive
+        {
+            void draw_rectangle(Window &win, int row, int col, int width, int height, const COLOR& color = COLOR(COLOR::RESET), char ch = '#')
+            {
+                if (col < 0 || col + width > win.get_w() || row < 0 || row + height > win.get_h())
+                    throw std::out_of_range("\nERROR: Rectangle dimensions exceed window bounds in draw_rectangle");
+
+                for (int r = row; r < row + height; r++)
+                    win.fill_span(r, col, width, ch, color);
+            }
+
+            // clipped to the window before rasterising, so the off-window part of a line costs nothing
+            void draw_line(Window& win, int x0, int y0, int x1, int y1, const COLOR& col, char ch = '#') {
+                echo::detail::LineWalk l = echo::detail::clip_line(x0, y0, x1, y1, win.get_w(), win.get_h());
+                echo::detail::walk_line(l, [&](int x, int y) { win.set_cell(y, x, ch, col); });
+            }
+        }
+        namespace Plots
+        {
+            // functions meant for static display, like album covers, titles, etc.
+            void wrap_around(Window &win, const std::string &msg, const COLOR& color = COLOR(COLOR::RESET))
+            {
+                win.clean_buffer();
+
+                int total_rows = win.get_rows();
+                size_t total_cols = win.get_cols();
+
+                size_t start = 0;
+                size_t msg_length = msg.length();
+
+                for (int r = 0; r < total_rows && start < msg_length; r++)
+                {
+                    std::string_view line(msg.data() + start, (std::min)(msg_length - start, total_cols));
+                    win.print(r, 0, line, color);
+                    start += line.length();
+                }
+            }
+
+            int getMaxBars(Window &win, int bar_width) { return (win.get_w()) / bar_width; }
+
+            void draw_bars(Window &win, const std::vector<int> &heights, int bar_width, const std::vector<COLOR> &colors = {}, char ch = '#')
+            {
+                if (heights.empty())
+                    throw std::invalid_argument("\nERROR: Heights vector is empty in draw_bars");
+                if (bar_width <= 0)
+                    throw std::invalid_argument("\nnERROR: Bar width must be positive in draw_bars");
+                if (heights.size() * bar_width > static_cast<size_t>(win.get_w()))
+                    throw std::out_of_range("\nnERROR: Bars exceed window width in draw_bars");
+                if (!colors.empty() && colors.size() != heights.size())
+                    throw std::invalid_argument("\nnERROR: Colors vector size must match heights vector size in draw_bars");
+
+                win.clean_buffer();
+
+                int total_rows = win.get_rows();
+                int cols = heights.size();
+                const COLOR default_color(COLOR::BLUE);
+
+                for (int i = 0; i < cols; i++)
+                {
+                    int bar_height = heights[i];
+                    const COLOR& color = colors.empty() ? default_color : colors[i];
+
+                    for (int r = (std::max)(total_rows - bar_height, 0); r < total_rows; r++)
+                        win.fill_span(r, i * bar_width, bar_width, ch, color);
+                }
+            }
+            
+            void draw_frame(Window &win, const std::vector<char> &chars, const std::vector<COLOR>& colors = {}) {
+                if (chars.size() != colors.size()) throw std::invalid_argument("Size of characters do not match size of colors vector!\n");
+                if (chars.size() != static_cast<size_t>(win.get_w() * win.get_h())) throw std::out_of_range("Total characters do not match window size!\n");
+
+                // cells that match the previous frame stay clean, so a still image costs nothing to render
+                win.blit(chars.data(), win.get_w(), colors.data(), win.get_w(), win.get_h(), win.get_w());
+            }
+
+            void draw_progress_bar(
+                Window &win, int row, 
+                int col, int width, 
+                int progress, 
+                const COLOR& color = COLOR(COLOR::GREEN),
+                char fill_ch = '#', char empty_ch = '='
+            ) {
+
+                if (col < 0 || col + width > win.get_w() || row < 0 || row >= win.get_h())
+                    throw std::out_of_range("\nERROR: Progress bar dimensions exceed window bounds in draw_progress_bar");
+
+                assert(progress >= 0 && progress <= 100 && "Termviz: Progress out of bounds!");
+
+                win.set_cell(row, col, '[', color);
+                win.set_cell(row, col + width - 1, ']', color);
+
+                width -= 2; // Adjust for brackets
+                col+=1; // Move inside the brackets
+                
+                int filled_length = static_cast<int>(width * (progress / 100.0f));
+                int empty_length = width - filled_length;
+
+                win.fill_span(row, col, filled_length, fill_ch, color);
+                win.fill_span(row, col + filled_length, empty_length, empty_ch, color);
+            }
+
+            void draw_progress_bar(
+                Window &win, int row, 
+                int col, int width, 
+                std::function<int()> progress_func, 
+                const COLOR& color = COLOR(COLOR::GREEN),
+                char fill_ch = '#', char empty_ch = '='
+            ) {
+                draw_progress_bar(win, row, col, width, progress_func(), color, fill_ch, empty_ch);
+            }
+        }
+        namespace ThreeD {
+
+            using namespace echo::ThreeD;
+
+            // Map Z to a brightness multiplier (e.g., further = darker)
+            // Adjust these values based on your scene depth
+            inline COLOR shade(const COLOR &color, float z) {
+                float brightness = 1.0f / (1.0f + (z * 0.1f));
+                return COLOR(
+                    static_cast<uint8_t>(color.r * brightness),
+                    static_cast<uint8_t>(color.g * brightness),
+                    static_cast<uint8_t>(color.b * brightness)
+                );
+            }
+
+            void draw_point3D(Window &win, const Point3D &point, const COLOR& color = COLOR(COLOR::RESET), char ch = '#') {
+                Point2D p2d = static_cast<Point2D>(point); // simple orthographic projection
+                if (p2d.x < 0 || p2d.x >= win.get_w() || p2d.y < 0 || p2d.y >= win.get_h())
+                    throw std::out_of_range("\nERROR: 3D Point projects outside window bounds in draw_point3D");
+
+                if (!win.depth_test(p2d.y, p2d.x, point.z))
+                    return;
+                win.set_cell(p2d.y, p2d.x, ch, color);
+            }
+
+            void draw_line3D(Window &win, const Point3D &p1, const Point3D &p2, const COLOR& color = COLOR(COLOR::RESET), char ch = '#') {
+                Point2D s = static_cast<Point2D>(p1);
+                Point2D e = static_cast<Point2D>(p2);
+
+                echo::detail::LineWalk l = echo::detail::clip_line(s.x, s.y, e.x, e.y, win.get_w(), win.get_h());
+
+                // Linear interpolation of Z, stepped once per pixel from the first visible one
+                float dz = l.major == 0 ? 0.0f : (p2.z - p1.z) / l.major;
+                float current_z = p1.z + l.first * dz;
+
+                echo::detail::walk_line(l, [&](int x, int y) {
+                    if (win.depth_test(y, x, current_z))
+                        win.set_cell(y, x, ch, shade(color, current_z));
+                    current_z += dz;
+                });
+            }
+
+            // perspective versions: world-space input seen through `cam`, clipped at the near plane and depth tested
+            void draw_point3D(Window &win, const Camera &cam, const Point3D &point, const COLOR& color = COLOR(COLOR::RESET), char ch = '#') {
+                Point3D v = cam.view * point;
+                if (v.z < cam.near_plane || v.z > cam.far_plane)
+                    return;
+                Point3D w = cam.to_window(v, win.get_w(), win.get_h());
+                int col = static_cast<int>(std::floor(w.x)), row = static_cast<int>(std::floor(w.y));
+                if (col < 0 || col >= win.get_w() || row < 0 || row >= win.get_h() || !win.depth_test(row, col, v.z))
+                    return;
+                win.set_cell(row, col, ch, shade(color, v.z));
+            }
+
+            namespace detail {
+                // a segment already in window coordinates, with z the view depth of each end: walked, depth tested and shaded
+                inline void draw_window_line(Window &win, const Point3D &wa, const Point3D &wb, const COLOR &color, char ch) {
+                    Point2D s(static_cast<int>(std::floor(wa.x)), static_cast<int>(std::floor(wa.y)));
+                    Point2D e(static_cast<int>(std::floor(wb.x)), static_cast<int>(std::floor(wb.y)));
+
+                    echo::detail::LineWalk l = echo::detail::clip_line(s.x, s.y, e.x, e.y, win.get_w(), win.get_h());
+
+                    // 1/z is linear in screen space, z itself is not
+                    float inv_a = 1.0f / wa.z, inv_b = 1.0f / wb.z;
+                    float d_inv_z = l.major == 0 ? 0.0f : (inv_b - inv_a) / l.major;
+                    float inv_z = inv_a + l.first * d_inv_z;
+
+                    echo::detail::walk_line(l, [&](int x, int y) {
+                        float current_z = 1.0f / inv_z;
+                        if (win.depth_test(y, x, current_z))
+                            win.set_cell(y, x, ch, shade(color, current_z));
+                        inv_z += d_inv_z;
+                    });
+                }
+            }
+
+            void draw_line3D(Window &win, const Camera &cam, const Point3D &p1, const Point3D &p2, const COLOR& color = COLOR(COLOR::RESET), char ch = '#') {
+                Point3D a = cam.view * p1, b = cam.view * p2;
+                if (!clip_depth(cam, a, b))
+                    return;
+                detail::draw_window_line(win, cam.to_window(a, win.get_w(), win.get_h()), cam.to_window(b, win.get_w(), win.get_h()), color, ch);
+            }
+
+            // light travels along `direction` in view space, surfaces facing against it are lit
+            struct Light {
+                Point3D direction = Point3D(0.4f, 0.6f, 1.0f);
+                float ambient = 0.15f;
+            };
+
+            // darkest to brightest, one glyph per shading level
+            inline constexpr std::string_view luminance_ramp = " .:-=+*#%@";
+
+            namespace detail {
+                // screen-space triangle ready for coverage tests, 1/z per vertex for perspective-correct depth
+                struct RasterTriangle {
+                    float x[3], y[3], inv_z[3];
+                    int min_x, max_x, min_y, max_y;
+                    char ch;
+                    COLOR color;
+                };
+
+                inline float edge(float ax, float ay, float bx, float by, float px, float py) {
+                    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+                }
+
+                // view-space triangle -> depth-clipped, culled, shaded screen triangles appended to `out`
+                inline void setup_triangle(const Camera &cam, const Point3D (&v)[3], int win_w, int win_h, const COLOR &color,
+                                           const Light &light, bool cull_backfaces, std::vector<RasterTriangle> &out) {
+                    // flat shading from the view-space face normal
+                    float ux = v[1].x - v[0].x, uy = v[1].y - v[0].y, uz = v[1].z - v[0].z;
+                    float wx = v[2].x - v[0].x, wy = v[2].y - v[0].y, wz = v[2].z - v[0].z;
+                    float nx = uy * wz - uz * wy, ny = uz * wx - ux * wz, nz = ux * wy - uy * wx;
+                    float nlen = std::sqrt(nx * nx + ny * ny + nz * nz);
+                    float llen = std::sqrt(light.direction.x * light.direction.x + light.direction.y * light.direction.y + light.direction.z * light.direction.z);
+                    if (nlen == 0.0f)
+                        return;
+                    float lambert = llen > 0 ? -(nx * light.direction.x + ny * light.direction.y + nz * light.direction.z) / (nlen * llen) : 1.0f;
+                    if (!cull_backfaces)
+                        lambert = std::abs(lambert);
+                    float intensity = std::clamp(light.ambient + (1.0f - light.ambient) * (std::max)(lambert, 0.0f), 0.0f, 1.0f);
+
+                    size_t level = static_cast<size_t>(intensity * (luminance_ramp.size() - 1) + 0.5f);
+                    char ch = luminance_ramp[(std::max)(level, size_t(1))]; // never shade a visible face as blank
+                    COLOR shaded(
+                        static_cast<uint8_t>(color.r * intensity),
+                        static_cast<uint8_t>(color.g * intensity),
+                        static_cast<uint8_t>(color.b * intensity)
+                    );
+
+                    // Sutherland-Hodgman against the near plane, then the far one as lines get in clip_depth;
+                    // a triangle becomes at most a quad, then at most a pentagon
+                    auto clip = [](const Point3D *in, int n, Point3D *out, float plane, bool keep_beyond) {
+                        int count = 0;
+                        for (int k = 0; k < n; k++) {
+                            const Point3D &a = in[k], &b = in[(k + 1) % n];
+                            bool a_in = (a.z >= plane) == keep_beyond, b_in = (b.z >= plane) == keep_beyond;
+                            if (a_in)
+                                out[count++] = a;
+                            if (a_in != b_in) {
+                                float t = (plane - a.z) / (b.z - a.z);
+                                out[count++] = Point3D(a.x + t * (b.x - a.x), a.y + t * (b.y - a.y), plane);
+                            }
+                        }
+                        return count;
+                    };
+                    Point3D near_cut[4], poly[5];
+                    int count = clip(v, 3, near_cut, cam.near_plane, true);
+                    if (count < 3)
+                        return;
+                    count = clip(near_cut, count, poly, cam.far_plane, false);
+                    if (count < 3)
+                        return;
+
+                    Point3D screen[5];
+                    for (int k = 0; k < count; k++)
+                        screen[k] = cam.to_window(poly[k], win_w, win_h);
+
+                    for (int k = 1; k + 1 < count; k++) {
+                        const Point3D *p[3] = {&screen[0], &screen[k], &screen[k + 1]};
+                        float area = edge(p[0]->x, p[0]->y, p[1]->x, p[1]->y, p[2]->x, p[2]->y);
+                        // counter-clockwise on screen (y down) faces the camera
+                        if (area == 0.0f || (cull_backfaces && area > 0.0f))
+                            continue;
+
+                        RasterTriangle t;
+                        for (int q = 0; q < 3; q++) {
+                            // keep every triangle in one winding so the coverage test below has a single sign
+                            const Point3D &src = area > 0.0f ? *p[2 - q] : *p[q];
+                            t.x[q] = src.x; t.y[q] = src.y; t.inv_z[q] = 1.0f / src.z;
+                        }
+                        t.min_x = (std::max)(static_cast<int>(std::floor((std::min)({t.x[0], t.x[1], t.x[2]}))), 0);
+                        t.max_x = (std::min)(static_cast<int>(std::ceil((std::max)({t.x[0], t.x[1], t.x[2]}))), win_w - 1);
+                        t.min_y = (std::max)(static_cast<int>(std::floor((std::min)({t.y[0], t.y[1], t.y[2]}))), 0);
+                        t.max_y = (std::min)(static_cast<int>(std::ceil((std::max)({t.y[0], t.y[1], t.y[2]}))), win_h - 1);
+                        if (t.min_x > t.max_x || t.min_y > t.max_y)
+                            continue;
+                        t.ch = ch;
+                        t.color = shaded;
+                        out.push_back(t);
+                    }
+                }
+
+                // edge functions sampled at cell centres, rows [row_begin, row_end) only
+                inline void rasterize(Window &win, const RasterTriangle &t, int row_begin, int row_end) {
+                    int y0 = (std::max)(t.min_y, row_begin), y1 = (std::min)(t.max_y, row_end - 1);
+                    float area = edge(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2]); // negative, see setup_triangle
+                    float inv_area = 1.0f / area;
+
+                    for (int row = y0; row <= y1; row++) {
+                        float py = row + 0.5f, px = t.min_x + 0.5f;
+                        float w0 = edge(t.x[1], t.y[1], t.x[2], t.y[2], px, py);
+                        float w1 = edge(t.x[2], t.y[2], t.x[0], t.y[0], px, py);
+                        float w2 = edge(t.x[0], t.y[0], t.x[1], t.y[1], px, py);
+                        // the edge functions are linear in x, so step them instead of re-evaluating
+                        float d0 = -(t.y[2] - t.y[1]), d1 = -(t.y[0] - t.y[2]), d2 = -(t.y[1] - t.y[0]);
+
+                        for (int col = t.min_x; col <= t.max_x; col++, w0 += d0, w1 += d1, w2 += d2) {
+                            if (w0 > 0.0f || w1 > 0.0f || w2 > 0.0f)
+                                continue;
+                            float inv_z = (w0 * t.inv_z[0] + w1 * t.inv_z[1] + w2 * t.inv_z[2]) * inv_area;
+                            if (!win.depth_test(row, col, 1.0f / inv_z))
+                                continue;
+                            win.set_cell(row, col, t.ch, t.color);
+                        }
+                    }
+                }
+
+                // split the window into full-width row bands, so no two workers touch the same cells, dirty words or row counters
+                inline void rasterize_tiled(Window &win, const std::vector<RasterTriangle> &tris, ThreadPool &pool) {
+                    if (tris.empty())
+                        return;
+                    int rows = win.get_h();
+                    int band = (std::max)(4, static_cast<int>((rows + pool.size() * 4 - 1) / (pool.size() * 4)));
+                    size_t bands = (rows + band - 1) / band;
+
+                    // bin by bounding box so each band only walks the triangles that reach it
+                    std::vector<std::vector<uint32_t>> bins(bands);
+                    for (size_t k = 0; k < tris.size(); k++)
+                        for (int b = tris[k].min_y / band; b <= tris[k].max_y / band; b++)
+                            bins[b].push_back(static_cast<uint32_t>(k));
+
+                    pool.parallel_for(bands, [&](size_t b) {
+                        int row_begin = static_cast<int>(b) * band;
+                        for (uint32_t k : bins[b])
+                            rasterize(win, tris[k], row_begin, row_begin + band);
+                    });
+                }
+            }
+
+            // filled, flat-shaded triangles: faces index into `vertices`, front faces wind counter-clockwise on screen.
+            // depth testing is always on, the window's depth buffer is created if it has none. throws before drawing
+            // anything when a face refers to a vertex the batch does not have
+            void draw_triangles(Window &win, const Camera &cam, const Mat4 &model, const VertexBatch &vertices,
+                                const std::vector<std::array<int, 3>> &faces, const COLOR& color = COLOR(COLOR::RESET),
+                                const Light &light = Light(), bool cull_backfaces = true, ThreadPool &pool = default_pool()) {
+                for (const std::array<int, 3> &f : faces)
+                    for (int k : f)
+                        if (k < 0 || static_cast<size_t>(k) >= vertices.size())
+                            throw std::out_of_range("\nERROR: Triangle refers to vertex " + std::to_string(k) + " of " +
+                                                    std::to_string(vertices.size()));
+                if (!win.has_depth())
+                    win.enable_depth();
+
+                VertexBatch view;
+                transform(cam.view * model, vertices, view);
+
+                std::vector<detail::RasterTriangle> tris;
+                tris.reserve(faces.size());
+                for (const std::array<int, 3> &f : faces) {
+                    Point3D v[3] = {view[f[0]], view[f[1]], view[f[2]]};
+                    detail::setup_triangle(cam, v, win.get_w(), win.get_h(), color, light, cull_backfaces, tris);
+                }
+                detail::rasterize_tiled(win, tris, pool);
+            }
+
+            void draw_triangle3D(Window &win, const Camera &cam, const Point3D &p0, const Point3D &p1, const Point3D &p2,
+                                 const COLOR& color = COLOR(COLOR::RESET), const Light &light = Light(), bool cull_backfaces = true) {
+                if (!win.has_depth())
+                    win.enable_depth();
+
+                std::vector<detail::RasterTriangle> tris;
+                Point3D v[3] = {cam.view * p0, cam.view * p1, cam.view * p2};
+                detail::setup_triangle(cam, v, win.get_w(), win.get_h(), color, light, cull_backfaces, tris);
+                for (const detail::RasterTriangle &t : tris)
+                    detail::rasterize(win, t, 0, win.get_h());
+            }
+        }
+    }
+
+    namespace detail {
+        // a whole file as read-only bytes: mmap(2) where there is one, read into memory otherwise
+        class MappedFile
+        {
+        private:
+            const uint8_t *bytes = nullptr;
+            size_t length = 0;
+#ifdef _WIN32
+            std::vector<uint8_t> storage;
+#endif
+
+        public:
+            explicit MappedFile(const std::string &path)
+            {
+#ifdef _WIN32
+                FILE *file = std::fopen(path.c_str(), "rb");
+                if (!file)
+                    throw std::invalid_argument("\nERROR: Cannot open " + path);
+                std::fseek(file, 0, SEEK_END);
+                long end = std::ftell(file);
+                std::fseek(file, 0, SEEK_SET);
+                storage.resize(end > 0 ? static_cast<size_t>(end) : 0);
+                storage.resize(std::fread(storage.data(), 1, storage.size(), file));
+                std::fclose(file);
+                bytes = storage.data();
+                length = storage.size();
+#else
+                int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                    throw std::invalid_argument("\nERROR: Cannot open " + path);
+                struct stat info{};
+                if (::fstat(fd, &info) == 0 && info.st_size > 0)
+                {
+                    void *mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (mapped != MAP_FAILED)
+                    {
+                        bytes = static_cast<const uint8_t *>(mapped);
+                        length = static_cast<size_t>(info.st_size);
+                        ::madvise(mapped, length, MADV_SEQUENTIAL);
+                    }
+                }
+                ::close(fd); // the mapping keeps the file alive
+                if (!bytes && info.st_size > 0)
+                    throw std::invalid_argument("\nERROR: Cannot map " + path);
+#endif
+            }
+            ~MappedFile()
+            {
+#ifndef _WIN32
+                if (bytes)
+                    ::munmap(const_cast<uint8_t *>(bytes), length);
+#endif
+            }
+            MappedFile(const MappedFile &) = delete;
+            MappedFile &operator=(const MappedFile &) = delete;
+
+            const uint8_t *data() const { return bytes; }
+            size_t size() const { return length; }
+
+            // ask the kernel to start reading [offset, offset + count) before anyone touches it
+            void prefetch(size_t offset, size_t count) const
+            {
+#ifndef _WIN32
+                static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+                size_t begin = offset / page * page;
+                if (bytes && begin < length)
+                    ::madvise(const_cast<uint8_t *>(bytes) + begin, (std::min)(offset + count, length) - begin, MADV_WILLNEED);
+#else
+                (void)offset; (void)count;
+#endif
+            }
+        };
+    }
 
     namespace ThreeD {
-            struct Point2D {
-                int x, y;
-                Point2D(int x=0, int y=0) : x(x), y(y) {}
+            // a wireframe model: vertices plus every edge once, whether it came from one polygon, two or a line element.
+            // each edge remembers the (up to two) faces beside it, so edges with only back faces behind them can be culled
+            class Mesh {
+            public:
+                static constexpr uint32_t no_face = UINT32_MAX;
+                struct Edge {
+                    uint32_t a, b;                           // a < b
+                    uint32_t faces[2] = {no_face, no_face}; // no_face in faces[0]: always drawn (a line, or a non-manifold edge)
+                };
+
+            private:
+                VertexBatch verts;
+                std::vector<std::array<uint32_t, 3>> faces; // one triangle per polygon, enough to tell which way it faces
+                std::vector<Edge> edge_list;
+                Point3D lo, hi;
+
+                // loading only: polygon outlines, flat, and every polygon side or line segment as (min << 32 | max, face)
+                std::vector<uint32_t> outline;
+                std::vector<uint32_t> outline_start;
+                std::vector<std::pair<uint64_t, uint32_t>> sides;
+
+                [[noreturn]] static void fail(const std::string &what) { throw std::invalid_argument("\nERROR: " + what); }
+
+                void add_side(uint32_t a, uint32_t b, uint32_t face) {
+                    if (a == b)
+                        return;
+                    if (a > b)
+                        std::swap(a, b);
+                    sides.emplace_back(uint64_t(a) << 32 | b, face);
+                }
+
+                void add_polygon(const uint32_t *idx, size_t n) {
+                    if (n < 2)
+                        return;
+                    if (n == 2) {
+                        add_side(idx[0], idx[1], no_face);
+                        return;
+                    }
+                    uint32_t face = static_cast<uint32_t>(outline_start.size());
+                    outline_start.push_back(static_cast<uint32_t>(outline.size()));
+                    outline.insert(outline.end(), idx, idx + n);
+                    for (size_t k = 0; k < n; k++)
+                        add_side(idx[k], idx[(k + 1) % n], face);
+                }
+
+                // sort the sides so each edge's entries sit together: one edge each, faces attached, in vertex order so the
+                // draw loop walks the projected vertices mostly forwards
+                void finish() {
+                    size_t n = verts.size();
+                    for (uint32_t k : outline)
+                        if (k >= n)
+                            throw std::out_of_range("\nERROR: Mesh face refers to vertex " + std::to_string(k + 1) + " of " + std::to_string(n));
+                    for (const auto &side : sides)
+                        if ((side.first & 0xffffffffu) >= n)
+                            throw std::out_of_range("\nERROR: Mesh edge refers to vertex " + std::to_string((side.first & 0xffffffffu) + 1) + " of " + std::to_string(n));
+
+                    // the largest triangle of each polygon's fan stands in for its orientation
+                    outline_start.push_back(static_cast<uint32_t>(outline.size()));
+                    faces.resize(outline_start.size() - 1);
+                    for (size_t f = 0; f + 1 < outline_start.size(); f++) {
+                        const uint32_t *idx = &outline[outline_start[f]];
+                        size_t count = outline_start[f + 1] - outline_start[f];
+                        Point3D o = verts[idx[0]];
+                        float best = -1.0f;
+                        for (size_t k = 1; k + 1 < count; k++) {
+                            Point3D u = verts[idx[k]], v = verts[idx[k + 1]];
+                            float ux = u.x - o.x, uy = u.y - o.y, uz = u.z - o.z, vx = v.x - o.x, vy = v.y - o.y, vz = v.z - o.z;
+                            float cx = uy * vz - uz * vy, cy = uz * vx - ux * vz, cz = ux * vy - uy * vx;
+                            float area = cx * cx + cy * cy + cz * cz;
+                            if (area > best) {
+                                best = area;
+                                faces[f] = {idx[0], idx[k], idx[k + 1]};
+                            }
+                        }
+                    }
+                    outline = {};
+                    outline_start = {};
+
+                    std::sort(sides.begin(), sides.end());
+                    edge_list.clear();
+                    for (size_t k = 0; k < sides.size();) {
+                        size_t run = k;
+                        while (run < sides.size() && sides[run].first == sides[k].first)
+                            run++;
+                        Edge e{static_cast<uint32_t>(sides[k].first >> 32), static_cast<uint32_t>(sides[k].first)};
+                        // sorted, so a line element (no_face) comes last; it or a third face means the edge is always drawn
+                        if (run - k <= 2 && sides[run - 1].second != no_face) {
+                            e.faces[0] = sides[k].second;
+                            e.faces[1] = run - k == 2 ? sides[k + 1].second : no_face;
+                        }
+                        edge_list.push_back(e);
+                        k = run;
+                    }
+                    sides = {};
+
+                    lo = hi = n ? verts[0] : Point3D();
+                    for (size_t k = 0; k < n; k++) {
+                        lo = Point3D((std::min)(lo.x, verts.x[k]), (std::min)(lo.y, verts.y[k]), (std::min)(lo.z, verts.z[k]));
+                        hi = Point3D((std::max)(hi.x, verts.x[k]), (std::max)(hi.y, verts.y[k]), (std::max)(hi.z, verts.z[k]));
+                    }
+                }
+
+                // ----------------- OBJ -----------------
+                static const char *skip_blanks(const char *p, const char *end) {
+                    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                        p++;
+                    return p;
+                }
+
+                static const char *read_float(const char *p, const char *end, float &value) {
+                    p = skip_blanks(p, end);
+                    if (p < end && *p == '+')
+                        p++;
+                    auto [next, ec] = std::from_chars(p, end, value);
+                    if (ec != std::errc())
+                        return nullptr;
+                    return next;
+                }
+
+                // "7", "7/2", "7//3" or "-1": the vertex part as a 0-based index
+                static const char *read_index(const char *p, const char *end, size_t vertex_count, uint32_t &index) {
+                    p = skip_blanks(p, end);
+                    long long value = 0;
+                    auto [next, ec] = std::from_chars(p, end, value);
+                    if (ec != std::errc() || value == 0)
+                        return nullptr;
+                    while (next < end && *next != ' ' && *next != '\t' && *next != '\r' && *next != '#')
+                        next++; // texture and normal indices
+                    long long resolved = value < 0 ? static_cast<long long>(vertex_count) + value : value - 1;
+                    if (resolved < 0 || resolved >= UINT32_MAX)
+                        return nullptr;
+                    index = static_cast<uint32_t>(resolved);
+                    return next;
+                }
+
+                void load_obj(const char *p, const char *end) {
+                    std::vector<uint32_t> poly;
+                    size_t line_no = 0;
+                    while (p < end) {
+                        const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+                        if (!eol)
+                            eol = end;
+                        line_no++;
+                        const char *stop = static_cast<const char *>(std::memchr(p, '#', eol - p));
+                        if (!stop)
+                            stop = eol; // a comment runs to the end of the line, after data or on its own
+                        const char *q = skip_blanks(p, stop);
+                        if (stop - q >= 2 && (q[1] == ' ' || q[1] == '\t') && (q[0] == 'v' || q[0] == 'f' || q[0] == 'l')) {
+                            char kind = q[0];
+                            q += 2;
+                            if (kind == 'v') {
+                                float x, y, z;
+                                if (!(q = read_float(q, stop, x)) || !(q = read_float(q, stop, y)) || !(q = read_float(q, stop, z)))
+                                    fail("Bad vertex on OBJ line " + std::to_string(line_no));
+                                verts.push_back(Point3D(x, y, z));
+                            }
+                            else {
+                                poly.clear();
+                                for (q = skip_blanks(q, stop); q < stop; q = skip_blanks(q, stop)) {
+                                    uint32_t index;
+                                    if (!(q = read_index(q, stop, verts.size(), index)))
+                                        fail("Bad index on OBJ line " + std::to_string(line_no));
+                                    poly.push_back(index);
+                                }
+                                if (kind == 'f')
+                                    add_polygon(poly.data(), poly.size());
+                                else
+                                    for (size_t k = 0; k + 1 < poly.size(); k++)
+                                        add_side(poly[k], poly[k + 1], no_face);
+                            }
+                        }
+                        p = eol + 1;
+                    }
+                }
+
+                // ----------------- PLY -----------------
+                enum class PlyType : uint8_t { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+                struct PlyProperty {
+                    std::string name;
+                    PlyType type = PlyType::Float32;
+                    bool list = false;
+                    PlyType count_type = PlyType::UInt8;
+                };
+                struct PlyElement {
+                    std::string name;
+                    size_t count = 0;
+                    std::vector<PlyProperty> properties;
+                };
+
+                static PlyType ply_type(std::string_view name) {
+                    static constexpr std::pair<std::string_view, PlyType> names[] = {
+                        {"char", PlyType::Int8}, {"int8", PlyType::Int8}, {"uchar", PlyType::UInt8}, {"uint8", PlyType::UInt8},
+                        {"short", PlyType::Int16}, {"int16", PlyType::Int16}, {"ushort", PlyType::UInt16}, {"uint16", PlyType::UInt16},
+                        {"int", PlyType::Int32}, {"int32", PlyType::Int32}, {"uint", PlyType::UInt32}, {"uint32", PlyType::UInt32},
+                        {"float", PlyType::Float32}, {"float32", PlyType::Float32}, {"double", PlyType::Float64}, {"float64", PlyType::Float64},
+                    };
+                    for (const auto &[text, type] : names)
+                        if (text == name)
+                            return type;
+                    fail("Unknown PLY property type " + std::string(name));
+                }
+
+                // one value of the body, ascii tokens or packed binary of either byte order
+                struct PlyReader {
+                    const char *p, *end;
+                    bool ascii, swap;
+
+                    double read(PlyType type) {
+                        if (ascii) {
+                            p = skip_blanks(p, end);
+                            while (p < end && (*p == '\n' || *p == ' ' || *p == '\t' || *p == '\r'))
+                                p++;
+                            if (p < end && *p == '+')
+                                p++;
+                            double value;
+                            auto [next, ec] = std::from_chars(p, end, value);
+                            if (ec != std::errc())
+                                fail("Bad number in PLY body");
+                            p = next;
+                            return value;
+                        }
+                        static constexpr size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+                        size_t size = sizes[static_cast<int>(type)];
+                        if (static_cast<size_t>(end - p) < size)
+                            fail("PLY body is truncated");
+                        uint8_t raw[8];
+                        std::memcpy(raw, p, size);
+                        if (swap)
+                            std::reverse(raw, raw + size);
+                        p += size;
+                        switch (type) {
+                        case PlyType::Int8:    { int8_t v; std::memcpy(&v, raw, 1); return v; }
+                        case PlyType::UInt8:   return raw[0];
+                        case PlyType::Int16:   { int16_t v; std::memcpy(&v, raw, 2); return v; }
+                        case PlyType::UInt16:  { uint16_t v; std::memcpy(&v, raw, 2); return v; }
+                        case PlyType::Int32:   { int32_t v; std::memcpy(&v, raw, 4); return v; }
+                        case PlyType::UInt32:  { uint32_t v; std::memcpy(&v, raw, 4); return v; }
+                        case PlyType::Float32: { float v; std::memcpy(&v, raw, 4); return v; }
+                        case PlyType::Float64: { double v; std::memcpy(&v, raw, 8); return v; }
+                        }
+                        return 0;
+                    }
+                };
+
+                static uint32_t ply_index(double value, const char *what) {
+                    if (!(value >= 0 && value < UINT32_MAX))
+                        fail(std::string("Bad vertex index in PLY ") + what);
+                    return static_cast<uint32_t>(value);
+                }
+
+                void load_ply(const char *p, const char *end) {
+                    std::vector<PlyElement> elements;
+                    bool ascii = false, swap = false, header_done = false;
+                    while (p < end && !header_done) {
+                        const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+                        if (!eol)
+                            fail("PLY header is truncated");
+                        std::vector<std::string_view> words;
+                        for (const char *q = p; q < eol;) {
+                            q = skip_blanks(q, eol);
+                            const char *w = q;
+                            while (q < eol && *q != ' ' && *q != '\t' && *q != '\r')
+                                q++;
+                            if (q > w)
+                                words.emplace_back(w, q - w);
+                        }
+                        p = eol + 1;
+                        if (words.empty() || words[0] == "ply" || words[0] == "comment" || words[0] == "obj_info")
+                            continue;
+                        if (words[0] == "end_header")
+                            header_done = true;
+                        else if (words[0] == "format" && words.size() >= 2) {
+                            ascii = words[1] == "ascii";
+                            swap = (words[1] == "binary_big_endian") == (std::endian::native == std::endian::little);
+                            if (!ascii && words[1] != "binary_little_endian" && words[1] != "binary_big_endian")
+                                fail("Unknown PLY format " + std::string(words[1]));
+                        }
+                        else if (words[0] == "element" && words.size() >= 3) {
+                            PlyElement element;
+                            element.name = words[1];
+                            if (std::from_chars(words[2].data(), words[2].data() + words[2].size(), element.count).ec != std::errc())
+                                fail("Bad PLY element count");
+                            elements.push_back(std::move(element));
+                        }
+                        else if (words[0] == "property" && !elements.empty()) {
+                            PlyProperty property;
+                            if (words.size() >= 5 && words[1] == "list") {
+                                property.list = true;
+                                property.count_type = ply_type(words[2]);
+                                property.type = ply_type(words[3]);
+                                property.name = words[4];
+                            }
+                            else if (words.size() >= 3) {
+                                property.type = ply_type(words[1]);
+                                property.name = words[2];
+                            }
+                            else
+                                fail("Bad PLY property");
+                            elements.back().properties.push_back(std::move(property));
+                        }
+                    }
+                    if (!header_done)
+                        fail("PLY header is truncated");
+
+                    PlyReader in{p, end, ascii, swap};
+                    std::vector<uint32_t> poly;
+                    for (const PlyElement &element : elements) {
+                        const bool vertex = element.name == "vertex", face = element.name == "face", edge = element.name == "edge";
+                        if (vertex)
+                            verts.reserve(element.count);
+                        for (size_t n = 0; n < element.count; n++) {
+                            float xyz[3] = {0, 0, 0};
+                            uint32_t ends[2] = {0, 0};
+                            poly.clear();
+                            for (const PlyProperty &property : element.properties) {
+                                if (property.list) {
+                                    size_t count = static_cast<size_t>(in.read(property.count_type));
+                                    bool indices = face && (property.name == "vertex_indices" || property.name == "vertex_index");
+                                    for (size_t k = 0; k < count; k++) {
+                                        double value = in.read(property.type);
+                                        if (indices)
+                                            poly.push_back(ply_index(value, "face"));
+                                    }
+                                    continue;
+                                }
+                                double value = in.read(property.type);
+                                if (vertex && property.name.size() == 1 && property.name[0] >= 'x' && property.name[0] <= 'z')
+                                    xyz[property.name[0] - 'x'] = static_cast<float>(value);
+                                else if (edge && (property.name == "vertex1" || property.name == "vertex2"))
+                                    ends[property.name.back() - '1'] = ply_index(value, "edge");
+                            }
+                            if (vertex)
+                                verts.push_back(Point3D(xyz[0], xyz[1], xyz[2]));
+                            else if (face)
+                                add_polygon(poly.data(), poly.size());
+                            else if (edge)
+                                add_side(ends[0], ends[1], no_face);
+                        }
+                    }
+                }
+
+            public:
+                // .obj (v, f and l elements) or .ply (ascii or binary, vertex/face/edge elements), told apart by content
+                explicit Mesh(const std::string &path) {
+                    echo::detail::MappedFile file(path);
+                    const char *p = reinterpret_cast<const char *>(file.data()), *end = p + file.size();
+                    if (file.size() >= 4 && std::memcmp(p, "ply", 3) == 0 && (p[3] == '\n' || p[3] == '\r'))
+                        load_ply(p, end);
+                    else
+                        load_obj(p, end);
+                    if (verts.size() == 0)
+                        fail("No vertices found in " + path);
+                    finish();
+                }
+
+                // from hand-made data, e.g. the edge pairs the wireframe examples use; faces are optional polygons
+                Mesh(const VertexBatch &vertices, const std::vector<std::pair<int, int>> &edges,
+                     const std::vector<std::vector<int>> &polygons = {}) : verts(vertices) {
+                    for (const auto &[a, b] : edges) {
+                        if (a < 0 || b < 0)
+                            fail("Negative vertex index in Mesh edge");
+                        add_side(static_cast<uint32_t>(a), static_cast<uint32_t>(b), no_face);
+                    }
+                    std::vector<uint32_t> poly;
+                    for (const std::vector<int> &polygon : polygons) {
+                        poly.clear();
+                        for (int k : polygon) {
+                            if (k < 0)
+                                fail("Negative vertex index in Mesh face");
+                            poly.push_back(static_cast<uint32_t>(k));
+                        }
+                        add_polygon(poly.data(), poly.size());
+                    }
+                    finish();
+                }
+
+                const VertexBatch &vertices() const { return verts; }
+                const std::vector<Edge> &edges() const { return edge_list; }
+                const std::vector<std::array<uint32_t, 3>> &face_triangles() const { return faces; }
+                size_t vertex_count() const { return verts.size(); }
+                size_t edge_count() const { return edge_list.size(); }
+                size_t face_count() const { return faces.size(); }
+
+                // axis-aligned bounds in model space
+                Point3D min_corner() const { return lo; }
+                Point3D max_corner() const { return hi; }
+                Point3D center() const { return Point3D((lo.x + hi.x) * 0.5f, (lo.y + hi.y) * 0.5f, (lo.z + hi.z) * 0.5f); }
+                float radius() const {
+                    float dx = hi.x - lo.x, dy = hi.y - lo.y, dz = hi.z - lo.z;
+                    return 0.5f * std::sqrt(dx * dx + dy * dy + dz * dz);
+                }
+            };
+
+            // per-frame scratch for draw_mesh, keep one per mesh being drawn so nothing is reallocated
+            struct MeshScratch {
+                VertexBatch view;
+                std::vector<float> sx, sy;
+                std::vector<uint8_t> front;
+            };
+    }
+
+    namespace Visualizer {
+        namespace ThreeD {
+            // draws each edge once. skipped without rasterising: edges whose faces both point away (cull_backfaces),
+            // edges entirely off one side of the window, and every edge when the bounding box is out of view.
+            // an edge that projects into a single cell (level of detail) only marks that cell
+            void draw_mesh(Window &win, const Camera &cam, const Mat4 &model, const Mesh &mesh, MeshScratch &scratch,
+                           const COLOR& color = COLOR(COLOR::RESET), char ch = '#', bool cull_backfaces = true) {
+                const int w = win.get_w(), h = win.get_h();
+                const Mat4 to_view = cam.view * model;
+
+                // the whole box behind the camera, past the far plane or off one side: nothing to do
+                Point3D lo = mesh.min_corner(), hi = mesh.max_corner();
+                int outside[6] = {0, 0, 0, 0, 0, 0};
+                for (int k = 0; k < 8; k++) {
+                    Point3D v = to_view * Point3D(k & 1 ? hi.x : lo.x, k & 2 ? hi.y : lo.y, k & 4 ? hi.z : lo.z);
+                    outside[0] += v.z < cam.near_plane;
+                    outside[1] += v.z > cam.far_plane;
+                    if (v.z >= cam.near_plane) {
+                        Point3D s = cam.to_window(v, w, h);
+                        outside[2] += s.x < 0;
+                        outside[3] += s.x >= w;
+                        outside[4] += s.y < 0;
+                        outside[5] += s.y >= h;
+                    }
+                }
+                if (outside[0] == 8 || outside[1] == 8 || (outside[0] == 0 && (outside[2] == 8 || outside[3] == 8 || outside[4] == 8 || outside[5] == 8)))
+                    return;
+
+                transform(to_view, mesh.vertices(), scratch.view);
+                const VertexBatch &view = scratch.view;
+                size_t n = view.size();
+                scratch.sx.resize(n);
+                scratch.sy.resize(n);
+                const float f = cam.focal(h), fx = f * cam.cell_aspect, half_w = 0.5f * w, half_h = 0.5f * h;
+                for (size_t k = 0; k < n; k++) {
+                    float inv = 1.0f / (std::max)(view.z[k], cam.near_plane);
+                    scratch.sx[k] = half_w + view.x[k] * fx * inv;
+                    scratch.sy[k] = half_h + view.y[k] * f * inv;
+                }
+
+                // a face points at the camera when its normal points back along the ray to it, as in draw_triangles
+                const auto &tris = mesh.face_triangles();
+                scratch.front.assign(tris.size(), 1);
+                if (cull_backfaces)
+                    for (size_t k = 0; k < tris.size(); k++) {
+                        Point3D a = view[tris[k][0]], b = view[tris[k][1]], c = view[tris[k][2]];
+                        float ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z, vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+                        float nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+                        scratch.front[k] = nx * a.x + ny * a.y + nz * a.z <= 0.0f; // degenerate faces count as facing
+                    }
+
+                for (const Mesh::Edge &e : mesh.edges()) {
+                    if (e.faces[0] != Mesh::no_face && !scratch.front[e.faces[0]] &&
+                        (e.faces[1] == Mesh::no_face || !scratch.front[e.faces[1]]))
+                        continue;
+
+                    float za = view.z[e.a], zb = view.z[e.b];
+                    if (za < cam.near_plane || zb < cam.near_plane || za > cam.far_plane || zb > cam.far_plane) {
+                        Point3D a = view[e.a], b = view[e.b]; // rare: crosses a depth plane, clip it first
+                        if (clip_depth(cam, a, b))
+                            detail::draw_window_line(win, cam.to_window(a, w, h), cam.to_window(b, w, h), color, ch);
+                        continue;
+                    }
+
+                    float ax = scratch.sx[e.a], ay = scratch.sy[e.a], bx = scratch.sx[e.b], by = scratch.sy[e.b];
+                    if ((ax < 0 && bx < 0) || (ax >= w && bx >= w) || (ay < 0 && by < 0) || (ay >= h && by >= h))
+                        continue;
+                    int cx = static_cast<int>(std::floor(ax)), cy = static_cast<int>(std::floor(ay));
+                    if (cx == static_cast<int>(std::floor(bx)) && cy == static_cast<int>(std::floor(by))) {
+                        float z = (std::min)(za, zb);
+                        if (win.depth_test(cy, cx, z))
+                            win.set_cell(cy, cx, ch, shade(color, z));
+                        continue;
+                    }
+                    detail::draw_window_line(win, Point3D(ax, ay, za), Point3D(bx, by, zb), color, ch);
+                }
+            }
+
+            void draw_mesh(Window &win, const Camera &cam, const Mat4 &model, const Mesh &mesh,
+                           const COLOR& color = COLOR(COLOR::RESET), char ch = '#', bool cull_backfaces = true) {
+                MeshScratch scratch;
+                draw_mesh(win, cam, model, mesh, scratch, color, ch, cull_backfaces);
+            }
+        }
+    }
+
+    enum class PlayerFormat { PPM, Raw };
+
+    struct PlayerOptions
+    {
+        PlayerFormat format = PlayerFormat::PPM;
+        int raw_width = 0, raw_height = 0; // frame size, PlayerFormat::Raw only
+        double fps = 30.0;                 // 0 plays every frame as fast as the pipeline allows, nothing is dropped
+        bool loop = false;
+        ColorMode color_mode = ColorMode::TrueColor; // dither towards the palette the window encodes with
+        bool dither = true;
+        std::string_view ramp = " .:-=+*#%@"; // glyphs from dark to bright
+        size_t queue_depth = 2;
+    };
+
+    class Player
+    { // plays raw RGB or PPM frames from disk into a window: read -> downscale -> quantise -> blit, one thread per stage
+    public:
+        using Format = PlayerFormat;
+        using Options = PlayerOptions;
+
+    private:
+        struct SourceFrame { const uint8_t *rgb = nullptr; int width = 0, height = 0; const detail::MappedFile *file = nullptr; int maxval = 255; };
+
+        // frames in flight; buffers travel back up the pipeline once used so steady playback allocates nothing
+        struct Timed { size_t index = 0; steady_clock::time_point due; };
+        struct ScaledFrame { std::vector<uint8_t> rgb; size_t index = 0; };
+        struct CellFrame { std::vector<char> chars; std::vector<COLOR> colors; size_t index = 0; };
+
+        struct Pipeline
+        {
+            detail::BoundedQueue<Timed> read;
+            detail::BoundedQueue<ScaledFrame> scaled, scaled_free;
+            detail::BoundedQueue<CellFrame> cells, cells_free;
+            std::vector<std::thread> stages;
+
+            explicit Pipeline(size_t depth) : read(depth), scaled(depth), scaled_free(depth + 2), cells(depth), cells_free(depth + 2) {}
+        };
+
+        Window &win;
+        Options options;
+        std::vector<std::unique_ptr<detail::MappedFile>> files;
+        std::vector<SourceFrame> frames;
+        std::unique_ptr<Pipeline> pipeline;
+        std::atomic<bool> stopping{false};
+        std::atomic<uint64_t> shown{0}, dropped{0};
+
+        // P6 with an 8-bit maxval, rescaled to 255 when lower; a file may hold several frames back to back (ffmpeg -f image2pipe)
+        static bool parse_ppm(const uint8_t *data, size_t size, size_t &pos, SourceFrame &frame)
+        {
+            auto skip_blank = [&] {
+                while (pos < size && (std::isspace(data[pos]) || data[pos] == '#'))
+                {
+                    if (data[pos] == '#')
+                        while (pos < size && data[pos] != '\n') pos++;
+                    else
+                        pos++;
+                }
+            };
+            auto number = [&](long &value) {
+                skip_blank();
+                if (pos >= size || !std::isdigit(data[pos]))
+                    return false;
+                value = 0;
+                while (pos < size && std::isdigit(data[pos]) && value < INT_MAX)
+                    value = value * 10 + (data[pos++] - '0');
+                return true;
             };
 
-            struct Point3D {
-                float x, y, z;
-                Point3D(float x=0, float y=0, float z=0) : x(x), y(y), z(z) {}
+            skip_blank();
+            if (pos + 2 > size || data[pos] != 'P' || data[pos + 1] != '6')
+                return false;
+            pos += 2;
+            long w, h, maxval;
+            if (!number(w) || !number(h) || !number(maxval) || w <= 0 || h <= 0 || maxval <= 0 || maxval > 255)
+                return false;
+            if (w > INT_MAX / 3 || h > INT_MAX / 3 || static_cast<size_t>(w) * 3 > SIZE_MAX / static_cast<size_t>(h))
+                return false; // a row's bytes must fit an int and the frame's a size_t
+            pos++; // exactly one whitespace byte before the pixels
+            size_t bytes = static_cast<size_t>(w) * h * 3;
+            if (pos > size || size - pos < bytes)
+                return false;
+            frame.rgb = data + pos;
+            frame.width = static_cast<int>(w);
+            frame.height = static_cast<int>(h);
+            frame.maxval = static_cast<int>(maxval);
+            pos += bytes;
+            return true;
+        }
+
+        // area average: each cell is the mean of the source pixels it covers, rows are summed once per band
+        static void downscale(const SourceFrame &src, int cols, int rows, uint8_t *out, std::vector<uint32_t> &acc)
+        {
+            size_t row_bytes = static_cast<size_t>(src.width) * 3;
+            for (int ty = 0; ty < rows; ty++)
+            {
+                int y0 = static_cast<int>(int64_t(ty) * src.height / rows);
+                int y1 = (std::max)(y0 + 1, static_cast<int>(int64_t(ty + 1) * src.height / rows));
+                acc.assign(row_bytes, 0);
+                for (int y = y0; y < y1; y++)
+                {
+                    const uint8_t *line = src.rgb + y * row_bytes;
+                    for (size_t i = 0; i < row_bytes; i++)
+                        acc[i] += line[i];
+                }
+                for (int tx = 0; tx < cols; tx++)
+                {
+                    int x0 = static_cast<int>(int64_t(tx) * src.width / cols);
+                    int x1 = (std::max)(x0 + 1, static_cast<int>(int64_t(tx + 1) * src.width / cols));
+                    uint32_t r = 0, g = 0, b = 0;
+                    for (int x = x0; x < x1; x++)
+                    {
+                        r += acc[x * 3];
+                        g += acc[x * 3 + 1];
+                        b += acc[x * 3 + 2];
+                    }
+                    // the mean, stretched from 0..maxval to 0..255 (samples over maxval clamp)
+                    uint64_t area = static_cast<uint64_t>(x1 - x0) * (y1 - y0) * src.maxval;
+                    uint8_t *cell = out + (static_cast<size_t>(ty) * cols + tx) * 3;
+                    cell[0] = static_cast<uint8_t>((std::min)((uint64_t(r) * 255 + area / 2) / area, uint64_t(255)));
+                    cell[1] = static_cast<uint8_t>((std::min)((uint64_t(g) * 255 + area / 2) / area, uint64_t(255)));
+                    cell[2] = static_cast<uint8_t>((std::min)((uint64_t(b) * 255 + area / 2) / area, uint64_t(255)));
+                }
+            }
+        }
+
+        // glyph from luminance, colour snapped towards the palette; both nudged by a 4x4 Bayer matrix
+        void quantise(const ScaledFrame &in, int cols, int rows, CellFrame &out) const
+        {
+            static constexpr uint8_t bayer[16] = {0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5};
+            const int levels = static_cast<int>(options.ramp.size());
+            const float step = options.color_mode == ColorMode::Palette256 ? 40.0f   // spacing of the xterm 6x6x6 cube
+                             : options.color_mode == ColorMode::Palette16  ? 128.0f
+                             : 0.0f;
+            for (int r = 0; r < rows; r++)
+            {
+                for (int c = 0; c < cols; c++)
+                {
+                    size_t i = static_cast<size_t>(r) * cols + c;
+                    const uint8_t *px = &in.rgb[i * 3];
+                    float offset = options.dither ? (bayer[(r & 3) * 4 + (c & 3)] + 0.5f) / 16.0f - 0.5f : 0.0f;
+
+                    float luma = (px[0] * 54 + px[1] * 183 + px[2] * 19) / (256.0f * 255.0f);
+                    int level = static_cast<int>(std::lround(luma * (levels - 1) + offset));
+                    out.chars[i] = options.ramp[std::clamp(level, 0, levels - 1)];
+
+                    auto snap = [&](uint8_t v) { return static_cast<uint8_t>(std::clamp(v + offset * step, 0.0f, 255.0f)); };
+                    out.colors[i] = COLOR(snap(px[0]), snap(px[1]), snap(px[2]));
+                }
+            }
+        }
+
+        void run_reader(Pipeline &p)
+        {
+            const bool paced = options.fps > 0.0;
+            const auto period = duration_cast<steady_clock::duration>(duration<double>(paced ? 1.0 / options.fps : 0.0));
+            auto due = steady_clock::now();
+            do
+            {
+                for (size_t i = 0; i < frames.size() && !stopping.load(std::memory_order_relaxed); i++)
+                {
+                    if (paced)
+                    {
+                        // a frame whose slot is already gone is skipped here, before anyone spends time on it
+                        auto now = steady_clock::now();
+                        if (now > due + period)
+                        {
+                            dropped.fetch_add(1, std::memory_order_relaxed);
+                            ECHO_STAT(detail::global_stats.drop();)
+                            due += period;
+                            continue;
+                        }
+                        std::this_thread::sleep_until(due);
+                    }
+                    if (i + 1 < frames.size())
+                    {
+                        const SourceFrame &next = frames[i + 1];
+                        next.file->prefetch(static_cast<size_t>(next.rgb - next.file->data()), size_t(next.width) * next.height * 3);
+                    }
+                    if (!p.read.push(Timed{i, due}))
+                        return;
+                    due += period;
+                }
+            } while (options.loop && !stopping.load(std::memory_order_relaxed));
+            p.read.close();
+        }
+
+        void run_scaler(Pipeline &p, int cols, int rows)
+        {
+            std::vector<uint32_t> acc;
+            Timed t;
+            while (p.read.pop(t))
+            {
+                ScaledFrame out;
+                p.scaled_free.try_pop(out);
+                out.rgb.resize(static_cast<size_t>(cols) * rows * 3);
+                out.index = t.index;
+                downscale(frames[t.index], cols, rows, out.rgb.data(), acc);
+                if (!p.scaled.push(std::move(out)))
+                    return;
+            }
+            p.scaled.close();
+        }
+
+        void run_quantiser(Pipeline &p, int cols, int rows)
+        {
+            const bool paced = options.fps > 0.0;
+            ScaledFrame in;
+            while (p.scaled.pop(in))
+            {
+                CellFrame out;
+                p.cells_free.try_pop(out);
+                out.chars.resize(static_cast<size_t>(cols) * rows);
+                out.colors.resize(static_cast<size_t>(cols) * rows);
+                out.index = in.index;
+                quantise(in, cols, rows, out);
+                p.scaled_free.try_push(in);
+
+                if (!paced)
+                {
+                    if (!p.cells.push(std::move(out)))
+                        return;
+                }
+                else
+                {
+                    // the terminal is behind: the oldest undrawn frame goes, the newest always gets through
+                    CellFrame evicted;
+                    if (p.cells.push_latest(std::move(out), evicted))
+                    {
+                        dropped.fetch_add(1, std::memory_order_relaxed);
+                        ECHO_STAT(detail::global_stats.drop();)
+                        p.cells_free.try_push(evicted);
+                    }
+                }
+            }
+            p.cells.close();
+        }
+
+        void run_blitter(Pipeline &p, int cols, int rows)
+        {
+            CellFrame frame;
+            while (p.cells.pop(frame))
+            {
+                if (stopping.load(std::memory_order_relaxed))
+                    break;
+                win.blit(frame.chars.data(), cols, frame.colors.data(), cols, rows, cols);
+                win.render();
+                shown.fetch_add(1, std::memory_order_relaxed);
+                p.cells_free.try_push(frame);
+            }
+        }
+
+    public:
+        // maps every file up front and indexes its frames; throws if a file cannot be read or holds no frame
+        Player(Window &win, const std::vector<std::string> &paths, const Options &opts = Options()) : win(win), options(opts)
+        {
+            if (options.ramp.empty())
+                throw std::invalid_argument("\nERROR: Player needs a non-empty glyph ramp");
+            if (options.format == Format::Raw && (options.raw_width <= 0 || options.raw_height <= 0))
+                throw std::invalid_argument("\nERROR: Raw playback needs raw_width and raw_height");
+
+            for (const std::string &path : paths)
+            {
+                files.push_back(std::make_unique<detail::MappedFile>(path));
+                const detail::MappedFile &file = *files.back();
+                size_t before = frames.size();
+
+                if (options.format == Format::Raw)
+                {
+                    size_t bytes = size_t(options.raw_width) * options.raw_height * 3;
+                    for (size_t pos = 0; pos + bytes <= file.size(); pos += bytes)
+                        frames.push_back(SourceFrame{file.data() + pos, options.raw_width, options.raw_height, &file});
+                }
+                else
+                {
+                    size_t pos = 0;
+                    SourceFrame frame;
+                    frame.file = &file;
+                    while (parse_ppm(file.data(), file.size(), pos, frame))
+                        frames.push_back(frame);
+                }
+                if (frames.size() == before)
+                    throw std::invalid_argument("\nERROR: No frames found in " + path);
+            }
+        }
+        ~Player() { stop(); }
+
+        Player(const Player &) = delete;
+        Player &operator=(const Player &) = delete;
+
+        size_t frame_count() const { return frames.size(); }
+        uint64_t frames_shown() const { return shown.load(std::memory_order_relaxed); }
+        uint64_t frames_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+        void start()
+        {
+            if (pipeline)
+                return;
+            stopping.store(false);
+            int cols = win.get_w(), rows = win.get_h();
+            pipeline = std::make_unique<Pipeline>(options.queue_depth);
+            Pipeline &p = *pipeline;
+            p.stages.emplace_back([this, &p] { run_reader(p); });
+            p.stages.emplace_back([this, &p, cols, rows] { run_scaler(p, cols, rows); });
+            p.stages.emplace_back([this, &p, cols, rows] { run_quantiser(p, cols, rows); });
+            p.stages.emplace_back([this, &p, cols, rows] { run_blitter(p, cols, rows); });
+        }
+
+        // blocks until every frame has gone through (forever with loop set, unless stop() is called)
+        void wait()
+        {
+            if (!pipeline)
+                return;
+            for (std::thread &stage : pipeline->stages)
+                stage.join();
+            pipeline.reset();
+        }
+
+        void stop()
+        {
+            if (!pipeline)
+                return;
+            stopping.store(true);
+            pipeline->read.close();
+            pipeline->scaled.close();
+            pipeline->cells.close();
+            wait();
+        }
+    };
+
+    class Replay
+    { // plays a Recorder file back: memory-mapped, and seeking starts from the nearest keyframe instead of the beginning
+    private:
+        struct Key { uint64_t time_us; size_t offset; };
+        struct Record { char type; uint64_t time_us; const uint8_t *payload; size_t size, next; };
+
+        detail::MappedFile map;
+        int cols = 0, rows = 0;
+        std::vector<Key> keys;
+        std::vector<COLOR> palette;
+        std::vector<char32_t> glyph_list; // the recording's clusters, interned here
+        size_t frames = 0;
+        uint64_t length_us = 0;
+        size_t body = 0, body_end = 0; // the records, without the index
+
+        std::vector<Cell> canvas;
+        size_t cursor = 0; // next record to read
+        uint64_t now_us = 0;
+
+        // false past the last record
+        bool read_record(size_t at, Record &r) const
+        {
+            if (at >= body_end)
+                return false;
+            const uint8_t *p = map.data() + at, *end = map.data() + body_end;
+            r.type = static_cast<char>(*p++);
+            r.time_us = r.type == 'K' || r.type == 'D' ? detail::get_varint(p, end) : 0;
+            r.size = detail::get_varint(p, end);
+            if (r.size > static_cast<size_t>(end - p))
+                throw std::out_of_range("\nERROR: Recording is truncated or corrupt");
+            r.payload = p;
+            r.next = static_cast<size_t>(p - map.data()) + r.size;
+            return true;
+        }
+
+        void read_palette(const uint8_t *p, const uint8_t *end, size_t count)
+        {
+            if (count > static_cast<size_t>(end - p) / 3)
+                throw std::out_of_range("\nERROR: Recording is truncated or corrupt");
+            for (size_t k = 0; k < count; k++, p += 3)
+                palette.emplace_back(p[0], p[1], p[2]);
+        }
+
+        void read_glyphs(const uint8_t *&p, const uint8_t *end, size_t count)
+        {
+            for (size_t k = 0; k < count; k++)
+            {
+                int width = detail::get_varint(p, end) == 2 ? 2 : 1;
+                size_t len = detail::get_varint(p, end);
+                if (len > static_cast<size_t>(end - p))
+                    throw std::out_of_range("\nERROR: Recording is truncated or corrupt");
+                glyph_list.push_back(detail::glyphs().intern(std::string_view(reinterpret_cast<const char *>(p), len), width));
+                p += len;
+            }
+        }
+
+        // no index, e.g. the recorder never got to close(): walk the record headers once, up to the last whole record
+        void scan()
+        {
+            body_end = map.size();
+            size_t at = body;
+            Record r;
+            try
+            {
+                while (read_record(at, r))
+                {
+                    if (r.type == 'P')
+                    {
+                        const uint8_t *p = r.payload, *end = r.payload + r.size;
+                        if (detail::get_varint(p, end) != palette.size())
+                            break;
+                        read_palette(p, end, static_cast<size_t>(end - p) / 3);
+                    }
+                    else if (r.type == 'G')
+                    {
+                        const uint8_t *p = r.payload, *end = r.payload + r.size;
+                        if (detail::get_varint(p, end) != glyph_list.size())
+                            break;
+                        while (p < end)
+                            read_glyphs(p, end, 1);
+                    }
+                    else if (r.type == 'K' || r.type == 'D')
+                    {
+                        if (r.type == 'K')
+                            keys.push_back({r.time_us, at});
+                        frames++;
+                        length_us = r.time_us;
+                    }
+                    else
+                        break;
+                    at = r.next;
+                }
+            }
+            catch (const std::out_of_range &) {}
+            body_end = at;
+        }
+
+        void apply(const Record &r, std::vector<Cell> &target) const
+        {
+            const uint8_t *p = r.payload, *end = r.payload + r.size;
+            size_t pos = 0;
+            uint32_t pen = 0;
+            auto corrupt = [] { return std::out_of_range("\nERROR: Recording is truncated or corrupt"); };
+
+            while (p < end)
+            {
+                uint64_t tag = detail::get_varint(p, end);
+                if (tag & 1)
+                {
+                    int top = static_cast<int>(detail::get_varint(p, end)), bottom = static_cast<int>(detail::get_varint(p, end));
+                    int n = static_cast<int>(detail::get_varint(p, end));
+                    if (top < 1 || bottom > rows || n < 1 || n > bottom - top + 1)
+                        throw corrupt();
+                    Cell *region = &target[(top - 1) * size_t(cols)];
+                    size_t height = size_t(bottom - top + 1);
+                    std::move(region + n * size_t(cols), region + height * cols, region);
+                    std::fill(region + (height - n) * cols, region + height * cols, Cell());
+                    continue;
+                }
+
+                uint64_t gap = tag >> 1;
+                pos += static_cast<size_t>(gap >> 1 ^ (0 - (gap & 1)));
+                uint64_t len = detail::get_varint(p, end);
+                if (pos > target.size() || len > target.size() - pos)
+                    throw corrupt();
+                while (len > 0)
+                {
+                    uint64_t head = detail::get_varint(p, end);
+                    uint64_t repeat = (head >> 1) + 1;
+                    if (head & 1)
+                        pen = static_cast<uint32_t>(detail::get_varint(p, end));
+                    char32_t ch = static_cast<char32_t>(detail::get_varint(p, end));
+                    if (repeat > len || pen >= palette.size())
+                        throw corrupt();
+                    Cell cell = ch == 0 ? Cell::continuation(palette[pen]) : Cell(ch, palette[pen]);
+                    if (ch >= detail::record_glyph_base)
+                    {
+                        if (ch - detail::record_glyph_base >= glyph_list.size())
+                            throw corrupt();
+                        cell = Cell(glyph_list[ch - detail::record_glyph_base], palette[pen]);
+                    }
+                    std::fill_n(&target[pos], repeat, cell);
+                    pos += repeat;
+                    len -= repeat;
+                }
+            }
+        }
+
+        // time of the next frame, false at the end
+        bool peek(uint64_t &time_us) const
+        {
+            Record r;
+            for (size_t at = cursor; read_record(at, r); at = r.next)
+                if (r.type == 'K' || r.type == 'D')
+                {
+                    time_us = r.time_us;
+                    return true;
+                }
+            return false;
+        }
+
+    public:
+        explicit Replay(const std::string &path) : map(path)
+        {
+            const uint8_t *p = map.data(), *end = p + map.size();
+            if (map.size() < detail::record_magic.size() ||
+                std::memcmp(p, detail::record_magic.data(), detail::record_magic.size()) != 0)
+                throw std::invalid_argument("\nERROR: " + path + " is not an echo recording");
+            p += detail::record_magic.size();
+            cols = static_cast<int>(detail::get_varint(p, end));
+            rows = static_cast<int>(detail::get_varint(p, end));
+            if (cols < 1 || rows < 1 || cols > 65535 || rows > 65535)
+                throw std::invalid_argument("\nERROR: " + path + " has an invalid size");
+            body = static_cast<size_t>(p - map.data());
+
+            const size_t trailer = 8 + detail::record_end_magic.size();
+            bool indexed = false;
+            if (map.size() >= body + trailer &&
+                std::memcmp(end - detail::record_end_magic.size(), detail::record_end_magic.data(), detail::record_end_magic.size()) == 0)
+            {
+                uint64_t index_at = 0;
+                for (int k = 0; k < 8; k++)
+                    index_at |= uint64_t(end[-static_cast<ptrdiff_t>(trailer) + k]) << (8 * k);
+                body_end = map.size() - trailer;
+                Record r;
+                if (index_at >= body && index_at < body_end && read_record(index_at, r) && r.type == 'I')
+                {
+                    const uint8_t *q = r.payload, *stop = r.payload + r.size;
+                    frames = detail::get_varint(q, stop);
+                    length_us = detail::get_varint(q, stop);
+                    size_t key_count = detail::get_varint(q, stop);
+                    if (key_count > r.size)
+                        throw std::out_of_range("\nERROR: Recording is truncated or corrupt");
+                    for (size_t k = 0; k < key_count; k++)
+                    {
+                        uint64_t time_us = detail::get_varint(q, stop);
+                        keys.push_back({time_us, static_cast<size_t>(detail::get_varint(q, stop))});
+                    }
+                    size_t colors = detail::get_varint(q, stop);
+                    read_palette(q, stop, colors);
+                    q += colors * 3;
+                    if (q < stop) // recordings made before glyphs were interned end with the palette
+                        read_glyphs(q, stop, detail::get_varint(q, stop));
+                    body_end = index_at;
+                    indexed = true;
+
+                    // seek() trusts these: in order, inside the body, each at the start of a keyframe
+                    for (size_t k = 0; k < keys.size(); k++)
+                        if (keys[k].offset < body || keys[k].offset >= body_end || map.data()[keys[k].offset] != 'K' ||
+                            (k && keys[k].time_us < keys[k - 1].time_us))
+                            throw std::out_of_range("\nERROR: Recording is truncated or corrupt");
+                }
+            }
+            if (!indexed)
+            {
+                keys.clear();
+                palette.clear();
+                glyph_list.clear();
+                scan();
+            }
+
+            canvas.assign(size_t(cols) * rows, Cell());
+            cursor = body;
+        }
+
+        int get_cols() const { return cols; }
+        int get_rows() const { return rows; }
+        size_t frame_count() const { return frames; }
+        microseconds duration() const { return microseconds(length_us); }
+        microseconds time() const { return microseconds(now_us); }
+
+        // the recorded terminal as of time(), 0-based like a Window
+        const Cell &at(int row, int col) const { return canvas.at(size_t(row) * cols + col); }
+        const std::vector<Cell> &cells() const { return canvas; }
+
+        // apply the next frame, false once there are none left
+        bool step()
+        {
+            Record r;
+            while (read_record(cursor, r))
+            {
+                cursor = r.next;
+                if (r.type == 'K' || r.type == 'D')
+                {
+                    apply(r, canvas);
+                    now_us = r.time_us;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // show the terminal as it was at t: decode the last keyframe at or before t, then the few deltas after it
+        void seek(microseconds t)
+        {
+            uint64_t target = static_cast<uint64_t>((std::max)(t.count(), decltype(t.count())(0)));
+            auto key = std::upper_bound(keys.begin(), keys.end(), target, [](uint64_t v, const Key &k) { return v < k.time_us; });
+
+            std::fill(canvas.begin(), canvas.end(), Cell());
+            cursor = body;
+            now_us = 0;
+            if (key != keys.begin())
+            {
+                Record r;
+                if (!read_record(std::prev(key)->offset, r) || r.type != 'K')
+                    throw std::out_of_range("\nERROR: Recording is truncated or corrupt");
+                apply(r, canvas);
+                cursor = r.next;
+                now_us = r.time_us;
+            }
+
+            uint64_t next;
+            while (peek(next) && next <= target)
+                step();
+        }
+
+        // copy the canvas into the window, only cells that differ from what it shows are redrawn
+        void show(Window &win) const
+        {
+            win.blit(canvas.data(), cols, rows, cols);
+        }
+
+        // play into a window at speed times real time from `from`, blocking until the end.
+        // frames that fall due while one is being drawn are folded into the next, so any speed keeps up
+        void play(Window &win, double speed = 1.0, microseconds from = microseconds(0))
+        {
+            if (!(speed > 0.0))
+                throw std::invalid_argument("\nERROR: Replay speed must be positive");
+            seek(from);
+            show(win);
+            win.render();
+
+            uint64_t origin = static_cast<uint64_t>((std::max)(from.count(), decltype(from.count())(0)));
+            auto started = steady_clock::now();
+            uint64_t next;
+            while (peek(next))
+            {
+                std::this_thread::sleep_until(started + duration_cast<steady_clock::duration>(std::chrono::duration<double, std::micro>((next - (std::min)(next, origin)) / speed)));
+                uint64_t reached = origin + static_cast<uint64_t>(std::chrono::duration<double, std::micro>(steady_clock::now() - started).count() * speed);
+                while (peek(next) && next <= reached)
+                    step();
+                show(win);
+                win.render();
+            }
+        }
+
+        // the whole recording as an asciicast v2 file, one output event per frame
+        void export_asciicast(const std::string &path) const
+        {
+            FILE *file = std::fopen(path.c_str(), "wb");
+            if (!file)
+                throw std::invalid_argument("\nERROR: Cannot open " + path + " for writing");
+            std::fprintf(file, "{\"version\": 2, \"width\": %d, \"height\": %d}\n", cols, rows);
+
+            std::vector<Cell> frame(size_t(cols) * rows, Cell());
+            detail::DamageGrid grid;
+            grid.resize(rows, cols);
+            MemorySink sink(cols, rows);
+            FrameEncoder out;
+            out.set_sink(sink);
+            out.set_right_edge(cols);
+            out.put("\033[0m\033[2J");
+
+            std::string event;
+            Record r;
+            for (size_t at = body; read_record(at, r); at = r.next)
+            {
+                if (r.type != 'K' && r.type != 'D')
+                    continue;
+                apply(r, frame);
+                for (int i = 0; i < rows; i++)
+                    grid.blit_row(i, 0, &frame[size_t(i) * cols], cols);
+                out.begin_frame();
+                grid.encode(out, 1, 1);
+                out.flush();
+
+                char stamp[32];
+                event.assign(stamp, std::snprintf(stamp, sizeof(stamp), "[%.6f, \"o\", \"", r.time_us / 1e6));
+                for (char ch : sink.contents())
+                {
+                    unsigned char byte = static_cast<unsigned char>(ch);
+                    if (ch == '"' || ch == '\\')
+                    {
+                        event += '\\';
+                        event += ch;
+                    }
+                    else if (byte < 0x20 || byte == 0x7f)
+                    {
+                        char escaped[8];
+                        event.append(escaped, std::snprintf(escaped, sizeof(escaped), "\\u%04x", byte));
+                    }
+                    else
+                        event += ch;
+                }
+                event += "\"]\n";
+                std::fwrite(event.data(), 1, event.size(), file);
+                sink.clear();
+            }
+            std::fclose(file);
+        }
+    };
+
+    class ProgressManager
+    { // thousands of tasks reporting through their own atomic, sampled and laid out once per frame by draw()
+    private:
+        static constexpr uint64_t failed_bit = uint64_t(1) << 63;
+
+        struct alignas(detail::cache_line) Task // one line each, so workers never share a cache line
+        {
+            std::atomic<uint64_t> done{0}; // units finished, failed_bit once the task gave up
+            uint64_t total = 0;
+            std::string label;
+        };
+
+        struct Sample // draw()'s own view of a task, workers never see it
+        {
+            uint64_t done = 0;
+            float rate = 0.0f; // units per second, smoothed
+        };
+
+        static constexpr size_t chunk_size = 256;
+
+        Window &win;
+        mutable std::mutex tasks_lock; // add() against draw(), workers never take it
+        std::vector<std::unique_ptr<Task[]>> chunks;
+        size_t count = 0;
+
+        std::vector<Sample> samples;
+        std::vector<size_t> listed;    // tasks on screen this frame
+        steady_clock::time_point last_draw;
+        bool drawn_once = false;
+        float rate = 0.0f;             // all tasks together
+        uint64_t last_done = 0;
+        bool show_all = false;
+        size_t first = 0;              // scroll position in show_all mode
+
+        Task &task(size_t i) const { return chunks[i / chunk_size][i % chunk_size]; }
+
+        // "1h02m", "4m05s", "12s", "--" when there is no estimate yet
+        static std::string_view format_eta(char (&buf)[16], double seconds)
+        {
+            if (!(seconds >= 0.0) || seconds > 359999.0)
+                return "--";
+            unsigned s = static_cast<unsigned>(seconds + 0.5);
+            int n = s >= 3600 ? std::snprintf(buf, sizeof(buf), "%uh%02um", s / 3600, s / 60 % 60)
+                  : s >= 60   ? std::snprintf(buf, sizeof(buf), "%um%02us", s / 60, s % 60)
+                              : std::snprintf(buf, sizeof(buf), "%us", s);
+            return std::string_view(buf, n);
+        }
+
+        // "950/s", "12.3k/s", "4.1M/s"
+        static std::string_view format_rate(char (&buf)[16], double per_second)
+        {
+            int n = per_second >= 1e6 ? std::snprintf(buf, sizeof(buf), "%.1fM/s", per_second / 1e6)
+                  : per_second >= 1e3 ? std::snprintf(buf, sizeof(buf), "%.1fk/s", per_second / 1e3)
+                                      : std::snprintf(buf, sizeof(buf), "%.0f/s", per_second);
+            return std::string_view(buf, n);
+        }
 
-                Point3D rotate(float angle) const {
-                    float rad = angle * 0.0174533f; // Convert degrees to radians
-                    
-                    // Rotate around Y-axis
-                    float nx = x * cos(rad) - z * sin(rad);
-                    float nz = x * sin(rad) + z * cos(rad);
-                    
-                    // Rotate around X-axis
-                    float ny = y * cos(rad) - nz * sin(rad);
-                    nz = y * sin(rad) + nz * cos(rad);
-                    
-                    return Point3D(nx, ny, nz);
-                }
+        // label, bar, percent and ETA on one row; the row is fully rewritten so stale text never lingers
+        void draw_task_row(int row, size_t i, int label_w)
+        {
+            const Task &t = task(i);
+            const Sample &s = samples[i];
+            int cols = win.get_w();
+            bool failed = s.done & failed_bit;
+            uint64_t done = (std::min)(s.done & ~failed_bit, t.total);
+            int percent = t.total ? static_cast<int>(done * 100 / t.total) : 100;
 
-                // for casting 3D to 2D
-                operator Point2D() const {
-                    return Point2D(x, y);
-                }
-            };
-    }
+            char eta_buf[16], tail[32];
+            std::string_view eta = failed ? "failed" : done >= t.total ? "done"
+                                 : format_eta(eta_buf, s.rate > 0.0f ? (t.total - done) / s.rate : -1.0);
+            int tail_n = std::snprintf(tail, sizeof(tail), " %3d%% %6.*s", percent, static_cast<int>(eta.size()), eta.data());
+            int bar_col = label_w + 1, bar_w = cols - bar_col - tail_n;
 
-    namespace Visualizer
-    {
-        namespace Primitive
+            win.fill_span(row, 0, cols, ' ');
+            win.print(row, 0, std::string_view(t.label.data(), (std::min)(t.label.size(), size_t(label_w))));
+            if (bar_w >= 3)
+                Visualizer::Plots::draw_progress_bar(win, row, bar_col, bar_w, percent, failed ? COLOR(COLOR::RED) : COLOR(COLOR::GREEN));
+            win.print(row, (std::max)(cols - tail_n, 0), std::string_view(tail, tail_n));
+        }
+
+    public:
+        class Handle
+        { // what a worker keeps: every update is a single relaxed store to its own cache line
+        private:
+            Task *t = nullptr;
+            explicit Handle(Task *t) : t(t) {}
+            friend class ProgressManager;
+
+        public:
+            Handle() = default;
+
+            void set(uint64_t done) { t->done.store(done, std::memory_order_relaxed); }
+            void finish() { set(t->total); }
+            void fail() { set(t->done.load(std::memory_order_relaxed) | failed_bit); }
+            uint64_t total() const { return t->total; }
+        };
+
+        explicit ProgressManager(Window &win) : win(win) {}
+
+        ProgressManager(const ProgressManager &) = delete;
+        ProgressManager &operator=(const ProgressManager &) = delete;
+
+        Handle add(std::string label, uint64_t total)
         {
-            void draw_rectangle(Window &win, int row, int col, int width, int height, const COLOR& color = COLOR(COLOR::RESET), char ch = '#')
-            {
-                if (col < 0 || col + width > win.get_w() || row < 0 || row + height > win.get_h())
-                    throw std::out_of_range("\nERROR: Rectangle dimensions exceed window bounds in draw_rectangle");
+            std::lock_guard<std::mutex> guard(tasks_lock);
+            if (count == chunks.size() * chunk_size)
+                chunks.push_back(std::make_unique<Task[]>(chunk_size));
+            Task &t = task(count++);
+            t.total = total;
+            t.label = std::move(label);
+            return Handle(&t);
+        }
 
-                for (int r = row; r < row + height; r++)
-                    win.print(r, col, std::string(width, ch), color);
-            }
+        size_t size() const
+        {
+            std::lock_guard<std::mutex> guard(tasks_lock);
+            return count;
+        }
 
-            void draw_line(Window& win, int x0, int y0, int x1, int y1, const COLOR& col, char ch = '#') {
-                // 1. Calculate distances and directions
-                int dx = std::abs(x1 - x0);
-                int dy = -std::abs(y1 - y0); // dy is negative in this algorithm
-                int sx = (x0 < x1) ? 1 : -1;  // Step direction for X
-                int sy = (y0 < y1) ? 1 : -1;  // Step direction for Y
-                
-                // 2. The 'Error' variable tracks the distance to the ideal line
-                int err = dx + dy; 
-                int e2; // Temporary variable for the decision check
+        // list every task from `first_task` on, instead of only the ones still running
+        void show_all_from(size_t first_task)
+        {
+            show_all = true;
+            first = first_task;
+        }
+        void show_running() { show_all = false; }
 
-                while (true) {
-                    // 3. Buffer-Safe Print
-                    // Check bounds before printing to prevent vector out-of-bounds
-                    if (x0 >= 0 && x0 < win.get_w() && y0 >= 0 && y0 < win.get_h()) {
-                        win.print(y0, x0, std::string(1, ch), col);
-                    }
+        // sample every task once, then lay out the two summary rows and as many task rows as fit.
+        // call at the frame rate from the thread that renders the window
+        void draw()
+        {
+            std::lock_guard<std::mutex> guard(tasks_lock);
+            auto now = steady_clock::now();
+            float dt = drawn_once ? duration<float>(now - last_draw).count() : 0.0f;
+            drawn_once = true;
+            last_draw = now;
+            samples.resize(count);
 
-                    // 4. If we've reached the destination, stop
-                    if (x0 == x1 && y0 == y1) break;
+            // ---- sample: one relaxed load per task ----
+            uint64_t done_sum = 0, total_sum = 0;
+            size_t finished = 0, failed = 0, running = 0;
+            listed.clear();
+            int rows = win.get_h(), cols = win.get_w();
+            size_t slots = rows > 2 ? static_cast<size_t>(rows - 2) : 0;
 
-                    // 5. Calculate step
-                    e2 = 2 * err;
-                    
-                    // Horizontal step check
-                    if (e2 >= dy) {
-                        err += dy;
-                        x0 += sx;
-                    }
-                    
-                    // Vertical step check
-                    if (e2 <= dx) {
-                        err += dx;
-                        y0 += sy;
-                    }
+            for (size_t i = 0; i < count; i++)
+            {
+                const Task &t = task(i);
+                Sample &s = samples[i];
+                uint64_t word = t.done.load(std::memory_order_relaxed);
+                uint64_t done = (std::min)(word & ~failed_bit, t.total);
+                if (dt > 0.0f)
+                {
+                    uint64_t before = (std::min)(s.done & ~failed_bit, t.total);
+                    float instant = done >= before ? (done - before) / dt : 0.0f;
+                    s.rate = s.rate == 0.0f ? instant : 0.7f * s.rate + 0.3f * instant;
                 }
+                s.done = word;
+
+                done_sum += done;
+                total_sum += t.total;
+                bool is_failed = word & failed_bit;
+                bool is_done = !is_failed && done >= t.total;
+                failed += is_failed;
+                finished += is_done;
+                bool is_running = !is_failed && !is_done && done > 0;
+                running += is_running;
+
+                if (show_all ? i >= first && listed.size() < slots : is_running && listed.size() < slots)
+                    listed.push_back(i);
+            }
+            if (dt > 0.0f)
+            {
+                float instant = done_sum >= last_done ? (done_sum - last_done) / dt : 0.0f;
+                rate = rate == 0.0f ? instant : 0.7f * rate + 0.3f * instant;
+            }
+            last_done = done_sum;
+
+            // ---- summary rows ----
+            char line[160], eta_buf[16], rate_buf[16];
+            if (rows >= 1)
+            {
+                size_t hidden = show_all ? count - (std::min)(count, first + listed.size()) : running - listed.size();
+                int n = std::snprintf(line, sizeof(line), "%zu/%zu done  %zu running  %zu failed  %zu queued  (+%zu not shown)",
+                                      finished, count, running, failed, count - finished - failed - running, hidden);
+                win.fill_span(0, 0, cols, ' ');
+                win.print(0, 0, std::string_view(line, (std::min)(n, cols)));
+            }
+            if (rows >= 2)
+            {
+                int percent = total_sum ? static_cast<int>(done_sum * 100 / total_sum) : 100;
+                std::string_view rate_s = format_rate(rate_buf, rate);
+                std::string_view eta = format_eta(eta_buf, rate > 0.0f ? (total_sum - done_sum) / rate : -1.0);
+                int n = std::snprintf(line, sizeof(line), " %3d%% %.*s eta %.*s", percent,
+                                      static_cast<int>(rate_s.size()), rate_s.data(), static_cast<int>(eta.size()), eta.data());
+                n = (std::min)(n, cols);
+                win.fill_span(1, 0, cols, ' ');
+                if (cols - n >= 3)
+                    Visualizer::Plots::draw_progress_bar(win, 1, 0, cols - n, percent, COLOR(COLOR::CYAN));
+                win.print(1, cols - n, std::string_view(line, n));
+            }
+
+            // ---- virtualised task rows: only what fits is formatted at all ----
+            size_t label_w = 0;
+            for (size_t i : listed)
+                label_w = (std::max)(label_w, task(i).label.size());
+            label_w = (std::min)(label_w, size_t(cols / 4));
+
+            for (size_t k = 0; k < slots; k++)
+            {
+                if (k < listed.size())
+                    draw_task_row(static_cast<int>(k) + 2, listed[k], static_cast<int>(label_w));
+                else
+                    win.fill_span(static_cast<int>(k) + 2, 0, cols, ' ');
             }
         }
-        namespace Plots
+    };
+    // a few rows of live numbers about the renderer itself, drawn into a window of your choosing
+    class StatsOverlay
+    {
+    private:
+        Window &win;
+        FrameStats last;
+        steady_clock::time_point last_at = steady_clock::now();
+
+        void row(int r, const char *fmt, auto... args)
         {
-            // functions meant for static display, like album covers, titles, etc.
-            void wrap_around(Window &win, const std::string &msg, const COLOR& color = COLOR(COLOR::RESET))
+            if (r >= win.get_h())
+                return;
+            char line[128];
+            int n = std::snprintf(line, sizeof(line), fmt, args...);
+            n = (std::min)((std::max)(n, 0), (std::min)(win.get_w(), int(sizeof(line)) - 1));
+            win.print(r, 0, std::string_view(line, n));
+            win.fill_span(r, n, win.get_w() - n, ' ');
+        }
+
+    public:
+        explicit StatsOverlay(Window &window) : win(window) {}
+
+        // per-frame averages since the previous draw, plus running totals; pass a window's or screen's snapshot to watch just that one
+        void draw(const FrameStats &now = stats_snapshot())
+        {
+            if (!stats_enabled)
             {
-                win.clean_buffer();
+                row(0, " stats compiled out (ECHO_ENABLE_STATS=0)");
+                return;
+            }
 
-                int total_rows = win.get_rows();
-                int total_cols = win.get_cols();
+            auto at = steady_clock::now();
+            double secs = (std::max)(duration<double>(at - last_at).count(), 1e-9);
+            FrameStats d = now;
+            d.frames -= last.frames; d.dirty_cells -= last.dirty_cells; d.cells_emitted -= last.cells_emitted;
+            d.runs -= last.runs; d.cursor_moves -= last.cursor_moves; d.color_switches -= last.color_switches;
+            d.bytes -= last.bytes; d.encode_ns -= last.encode_ns; d.write_ns -= last.write_ns;
+            d.lock_wait_ns -= last.lock_wait_ns; d.dropped_frames -= last.dropped_frames;
+            last = now;
+            last_at = at;
 
-                size_t start = 0;
-                size_t msg_length = msg.length();
+            double per = d.frames ? 1.0 / static_cast<double>(d.frames) : 0.0;
+            row(0, " %.1f fps  %.1f KB/s  dropped %llu (%llu total)", d.frames / secs, d.bytes / secs / 1024.0,
+                static_cast<unsigned long long>(d.dropped_frames), static_cast<unsigned long long>(now.dropped_frames));
+            row(1, " per frame: %.0f dirty  %.0f emitted  %.0f runs", d.dirty_cells * per, d.cells_emitted * per, d.runs * per);
+            row(2, " per frame: %.0f bytes  %.0f moves  %.0f colours", d.bytes * per, d.cursor_moves * per, d.color_switches * per);
+            row(3, " per frame: encode %.3fms  write %.3fms  lock %.3fms", d.encode_ns * per / 1e6, d.write_ns * per / 1e6, d.lock_wait_ns * per / 1e6);
+        }
+    };
 
-                for (int r = 0; r < total_rows && start < msg_length; r++)
-                {
-                    std::string line;
-                    size_t remaining = msg_length - start;
+#ifdef __linux__
+    // ----------------- INPUT & EVENT LOOP -----------------
+    enum class EventType : uint8_t { Key, Mouse, Resize };
+    enum class MouseAction : uint8_t { Press, Release, Drag, Move, WheelUp, WheelDown };
 
-                    if (remaining <= total_cols)
-                        line = msg.substr(start, remaining);
-                    else
-                        line = msg.substr(start, total_cols);
+    struct Event
+    {
+        // keys that have no code point of their own, kept above the Unicode range
+        static constexpr char32_t Up = 0x110000, Down = 0x110001, Right = 0x110002, Left = 0x110003;
+        static constexpr char32_t Home = 0x110004, End = 0x110005, PageUp = 0x110006, PageDown = 0x110007;
+        static constexpr char32_t Insert = 0x110008, Delete = 0x110009;
+        static constexpr char32_t F1 = 0x110010; // F1 + n - 1 for Fn, up to F12
+        static constexpr char32_t Enter = '\r', Tab = '\t', Escape = 0x1b, Backspace = 0x7f;
 
-                    win.print(r, 0, line, color);
-                    start += line.length();
+        static constexpr uint8_t Shift = 1, Alt = 2, Ctrl = 4; // the xterm modifier bits
+
+        EventType type = EventType::Key;
+        char32_t key = 0;  // Key: a code point (Ctrl+C is 'c' with Ctrl) or one of the values above
+        uint8_t mods = 0;
+
+        MouseAction action = MouseAction::Press; // Mouse only
+        int button = 0;    // 0 left, 1 middle, 2 right
+        int x = 0, y = 0;  // 1-based terminal cell
+
+        int cols = 0, rows = 0; // Resize only
+    };
+
+    namespace detail {
+        // tty bytes to key and mouse events; an escape sequence split across reads waits in `pending` for the rest
+        class InputParser
+        {
+        private:
+            std::string pending;
+
+            static Event key(char32_t code, uint8_t mods = 0)
+            {
+                Event ev;
+                ev.key = code;
+                ev.mods = mods;
+                return ev;
+            }
+
+            static char32_t tilde_key(int n)
+            {
+                switch (n)
+                {
+                case 1: case 7: return Event::Home;
+                case 2: return Event::Insert;
+                case 3: return Event::Delete;
+                case 4: case 8: return Event::End;
+                case 5: return Event::PageUp;
+                case 6: return Event::PageDown;
+                case 11: case 12: case 13: case 14: case 15: return Event::F1 + (n - 11);
+                case 17: case 18: case 19: case 20: case 21: return Event::F1 + (n - 12);
+                case 23: case 24: return Event::F1 + (n - 13);
+                default: return 0;
                 }
             }
 
-            int getMaxBars(Window &win, int bar_width) { return (win.get_w()) / bar_width; }
+            static char32_t letter_key(char final)
+            {
+                switch (final)
+                {
+                case 'A': return Event::Up;
+                case 'B': return Event::Down;
+                case 'C': return Event::Right;
+                case 'D': return Event::Left;
+                case 'H': return Event::Home;
+                case 'F': return Event::End;
+                case 'P': case 'Q': case 'R': case 'S': return Event::F1 + (final - 'P');
+                default: return 0;
+                }
+            }
 
-            void draw_bars(Window &win, const std::vector<int> &heights, int bar_width, const std::vector<COLOR> &colors = {}, char ch = '#')
+            // one event from the front of s: bytes used, 0 when s ends mid-sequence; a key of 0 is a sequence we skip.
+            // at_end means nothing more is coming, so an unfinished sequence is taken as it stands
+            static size_t parse(std::string_view s, Event &ev, bool at_end)
             {
-                if (heights.empty())
-                    throw std::invalid_argument("\nERROR: Heights vector is empty in draw_bars");
-                if (bar_width <= 0)
-                    throw std::invalid_argument("\nnERROR: Bar width must be positive in draw_bars");
-                if (heights.size() * bar_width > win.get_w())
-                    throw std::out_of_range("\nnERROR: Bars exceed window width in draw_bars");
-                if (!colors.empty() && colors.size() != heights.size())
-                    throw std::invalid_argument("\nnERROR: Colors vector size must match heights vector size in draw_bars");
+                unsigned char c = static_cast<unsigned char>(s[0]);
+                if (c == 0x1b)
+                {
+                    if (s.size() == 1)
+                        return at_end ? (ev = key(Event::Escape), 1) : 0;
+                    if (s[1] == '[')
+                    {
+                        size_t k = 2;
+                        while (k < s.size() && !(s[k] >= 0x40 && s[k] <= 0x7e))
+                            k++;
+                        if (k == s.size())
+                            return at_end ? s.size() : 0;
 
-                win.clean_buffer();
+                        std::string_view body = s.substr(2, k - 2);
+                        char final = s[k];
+                        bool sgr_mouse = !body.empty() && body[0] == '<';
+                        int params[4] = {0, 0, 0, 0}, count = 0;
+                        for (char ch : sgr_mouse ? body.substr(1) : body)
+                        {
+                            if (ch == ';')
+                                count = (std::min)(count + 1, 3);
+                            else if (ch >= '0' && ch <= '9')
+                                params[count] = (std::min)(params[count] * 10 + (ch - '0'), 1 << 20);
+                        }
 
-                int total_rows = win.get_rows();
-                int cols = heights.size();
+                        if (sgr_mouse && (final == 'M' || final == 'm'))
+                        {
+                            int b = params[0];
+                            ev = Event();
+                            ev.type = EventType::Mouse;
+                            ev.x = params[1];
+                            ev.y = params[2];
+                            ev.button = b & 3;
+                            ev.mods = static_cast<uint8_t>((b & 4 ? Event::Shift : 0) | (b & 8 ? Event::Alt : 0) | (b & 16 ? Event::Ctrl : 0));
+                            if (b & 64)
+                                ev.action = (b & 1) ? MouseAction::WheelDown : MouseAction::WheelUp;
+                            else if (b & 32)
+                                ev.action = (b & 3) == 3 ? MouseAction::Move : MouseAction::Drag;
+                            else
+                                ev.action = final == 'm' ? MouseAction::Release : MouseAction::Press;
+                            return k + 1;
+                        }
 
-                for (int i = 0; i < cols; i++)
-                {
-                    int bar_height = heights[i];
-                    const COLOR& color = colors.empty() ? COLOR(COLOR::BLUE) : colors[i];
+                        uint8_t mods = params[1] > 1 ? static_cast<uint8_t>((params[1] - 1) & 7) : 0;
+                        char32_t code = final == '~' ? tilde_key(params[0]) : letter_key(final);
+                        ev = key(code, mods);
+                        return k + 1;
+                    }
+                    if (s[1] == 'O')
+                    {
+                        if (s.size() < 3)
+                            return at_end ? (ev = key('O', Event::Alt), 2) : 0;
+                        ev = key(letter_key(s[2]));
+                        return 3;
+                    }
+                    size_t used = parse(s.substr(1), ev, at_end);
+                    if (used == 0)
+                        return 0;
+                    ev.mods |= Event::Alt;
+                    return used + 1;
+                }
+
+                if (c == '\r' || c == '\n') return (ev = key(Event::Enter), 1);
+                if (c == '\t') return (ev = key(Event::Tab), 1);
+                if (c == 0x7f || c == 0x08) return (ev = key(Event::Backspace), 1);
+                if (c == 0) return (ev = key(' ', Event::Ctrl), 1);
+                if (c < 0x20) return (ev = key(U'a' + (c - 1), Event::Ctrl), 1);
+
+                size_t len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 1;
+                if (s.size() < len)
+                    return at_end ? (ev = key(0xfffd), s.size()) : 0;
+                char32_t code = len == 1 ? c : c & (0x7f >> len);
+                for (size_t k = 1; k < len; k++)
+                    code = code << 6 | (static_cast<unsigned char>(s[k]) & 0x3f);
+                ev = key(code);
+                return len;
+            }
 
-                    for (int r = total_rows - bar_height; r < total_rows; r++)
-                        win.print(r, i * bar_width, std::string(bar_width, ch), color);
+            template <typename F>
+            void drain(bool at_end, F &&emit)
+            {
+                size_t at = 0;
+                while (at < pending.size())
+                {
+                    Event ev;
+                    size_t used = parse(std::string_view(pending).substr(at), ev, at_end);
+                    if (used == 0)
+                        break;
+                    at += used;
+                    if (ev.type != EventType::Key || ev.key)
+                        emit(ev);
                 }
+                pending.erase(0, at);
             }
-            
-            void draw_frame(Window &win, const std::vector<char> &chars, const std::vector<COLOR>& colors = {}) {
-                if (chars.size() != colors.size()) throw std::invalid_argument("Size of characters do not match size of colors vector!\n");
-                if (chars.size() != win.get_w() * win.get_h()) throw std::out_of_range("Total characters do not match window size!\n");
 
-                win.clean_buffer();
+        public:
+            template <typename F>
+            void feed(const char *data, size_t size, F &&emit)
+            {
+                pending.append(data, size);
+                drain(false, emit);
+            }
 
-                int total_chars = chars.size();
-                int max_width = win.get_w();
-                for (int i = 0; i < total_chars; i++) {
-                    int x = i % max_width;
-                    int y = i / max_width;
+            // nothing followed for a while: a lone ESC was the Escape key after all
+            template <typename F>
+            void flush(F &&emit) { drain(true, emit); }
 
-                    win.print(y, x, std::string(1, chars[i]), colors[i]);
-                }
+            bool waiting() const { return !pending.empty(); }
+        };
+
+        inline std::atomic<int> winch_fd{-1};
+
+        inline void on_winch(int)
+        {
+            int saved = errno;
+            int fd = winch_fd.load(std::memory_order_relaxed);
+            if (fd >= 0)
+            {
+                uint64_t one = 1;
+                (void)!::write(fd, &one, sizeof(one));
             }
+            errno = saved;
+        }
 
-            void draw_progress_bar(
-                Window &win, int row, 
-                int col, int width, 
-                std::function<int()> progress_func, 
-                const COLOR& color = COLOR(COLOR::GREEN),
-                char fill_ch = '#', char empty_ch = '='
-            ) {
+        // SIGINT/SIGTERM only wake the loop; it restores the terminal and raises the signal again from run()
+        inline std::atomic<int> quit_fd{-1};
+        inline std::atomic<int> quit_signal{0};
 
-                if (col < 0 || col + width > win.get_w() || row < 0 || row >= win.get_h())
-                    throw std::out_of_range("\nERROR: Progress bar dimensions exceed window bounds in draw_progress_bar");
+        inline void on_quit(int sig)
+        {
+            int saved = errno;
+            quit_signal.store(sig, std::memory_order_relaxed);
+            int fd = quit_fd.load(std::memory_order_relaxed);
+            if (fd >= 0)
+            {
+                uint64_t one = 1;
+                (void)!::write(fd, &one, sizeof(one));
+            }
+            errno = saved;
+        }
+    }
 
-                int progress = progress_func();
-                assert(progress >= 0 && progress <= 100 && "Termviz: Progress out of bounds!");
+    // what a frame callback is told about its tick
+    struct Tick
+    {
+        uint64_t frame = 0;       // frames run so far, this one included
+        nanoseconds dt{0};        // since the previous frame started, the period when catching up
+        uint64_t skipped = 0;     // ticks dropped so far because a frame overran
+    };
+
+    enum class Pacing : uint8_t
+    {
+        Skip,    // after an overrun, run one frame and realign to the next deadline
+        CatchUp, // run the missed frames back to back, up to max_catch_up, e.g. for a fixed-step simulation
+    };
 
-                win.print(row, col, "[", color);
-                win.print(row, col + width - 1, "]", color);
+    struct EventLoopOptions
+    {
+        int input_fd = STDIN_FILENO;
+        bool raw = true;              // no line buffering or echo while the loop is alive
+        bool mouse = false;           // SGR mouse reporting: presses, drags and the wheel
+        bool keep_signals = true;     // Ctrl+C still interrupts, once the terminal is put back; false hands it over as a key
+        Pacing pacing = Pacing::Skip;
+        int max_catch_up = 4;
+        milliseconds escape_delay = milliseconds(25); // how long a lone ESC waits to become the start of a sequence
+    };
 
-                width -= 2; // Adjust for brackets
-                col+=1; // Move inside the brackets
-                
-                int filled_length = static_cast<int>(width * (progress / 100.0f));
-                int empty_length = width - filled_length;
+    class EventLoop
+    { // one thread, one epoll: keys, mouse and SIGWINCH as they arrive, frames on deadline-aligned timerfd ticks
+    public:
+        using Options = EventLoopOptions;
+
+    private:
+        Options options;
+        nanoseconds period;
+        Sink &sink;
+        int epoll_fd = -1, timer_fd = -1, wake_fd = -1, resize_fd = -1;
+        std::atomic<bool> running{false};
+
+        termios saved_tty{};
+        bool tty_saved = false, mouse_on = false, quit_armed = false;
+        struct sigaction saved_winch{}, saved_int{}, saved_term{};
+
+        detail::InputParser parser;
+        steady_clock::time_point input_stalled; // when the parser started waiting on an unfinished sequence
+        std::function<void(const Event &)> event_handler;
+        std::function<void(const Tick &)> frame_handler;
+        Tick tick;
+        steady_clock::time_point last_frame;
+
+        bool watch(int fd)
+        {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            return ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+        }
 
-                std::string filled_part(filled_length, fill_ch);
-                std::string empty_part(empty_length, empty_ch);
+        void emit(const Event &ev)
+        {
+            if (event_handler)
+                event_handler(ev);
+        }
+
+        void run_frames(uint64_t due)
+        {
+            uint64_t run = options.pacing == Pacing::CatchUp ? (std::min)(due, uint64_t((std::max)(options.max_catch_up, 1))) : 1;
+            tick.skipped += due - run;
+            ECHO_STAT(if (due > run) detail::global_stats.drop(due - run);)
 
-                win.print(row, col, filled_part + empty_part, color);
+            for (uint64_t k = 0; k < run && running.load(std::memory_order_relaxed); k++)
+            {
+                auto now = steady_clock::now();
+                tick.frame++;
+                tick.dt = k == 0 ? duration_cast<nanoseconds>(now - last_frame) : period;
+                if (k == 0)
+                    last_frame = now;
+                if (frame_handler)
+                    frame_handler(tick);
             }
         }
-        namespace ThreeD {
 
-            using namespace echo::ThreeD;
+        void read_input()
+        {
+            char bytes[4096];
+            ssize_t got = ::read(options.input_fd, bytes, sizeof(bytes)); // epoll said readable, so this won't block
+            if (got > 0)
+            {
+                bool was_waiting = parser.waiting();
+                parser.feed(bytes, static_cast<size_t>(got), [this](const Event &ev) { emit(ev); });
+                if (!was_waiting)
+                    input_stalled = steady_clock::now();
+            }
+            else if (got == 0 || (errno != EINTR && errno != EAGAIN))
+                ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, options.input_fd, nullptr); // input closed, keep animating
+        }
 
-            void draw_point3D(Window &win, const Point3D &point, const COLOR& color = COLOR(COLOR::RESET), char ch = '#') {
-                Point2D p2d = static_cast<Point2D>(point); // simple orthographic projection
-                if (p2d.x < 0 || p2d.x >= win.get_w() || p2d.y < 0 || p2d.y >= win.get_h())
-                    throw std::out_of_range("\nERROR: 3D Point projects outside window bounds in draw_point3D");
+        void close_fds()
+        {
+            for (int *fd : {&epoll_fd, &timer_fd, &wake_fd, &resize_fd})
+                if (*fd >= 0)
+                {
+                    ::close(*fd);
+                    *fd = -1;
+                }
+        }
+
+        // idempotent: from the destructor, or from run() before a caught signal is raised again
+        void restore_terminal()
+        {
+            if (mouse_on)
+            {
+                std::lock_guard<std::mutex> lock(screen_lock);
+                sink.write("\033[?1002l\033[?1006l");
+                mouse_on = false;
+            }
+            if (tty_saved)
+            {
+                ::tcsetattr(options.input_fd, TCSANOW, &saved_tty);
+                tty_saved = false;
+            }
+            if (quit_armed)
+            {
+                ::sigaction(SIGINT, &saved_int, nullptr);
+                ::sigaction(SIGTERM, &saved_term, nullptr);
+                detail::quit_fd.store(-1);
+                quit_armed = false;
+            }
+        }
+
+        static uint64_t drain_counter(int fd)
+        {
+            uint64_t count = 0;
+            return ::read(fd, &count, sizeof(count)) == sizeof(count) ? count : 0;
+        }
+
+    public:
+        // period is the frame interval, e.g. 60_FPS; frames tick on absolute deadlines so they never drift
+        explicit EventLoop(nanoseconds period, Options options = {}, Sink &sink = default_sink())
+            : options(options), period(period), sink(sink)
+        {
+            if (period <= nanoseconds(0))
+                throw std::invalid_argument("\nERROR: Frame period must be positive");
 
-                win.print(p2d.y, p2d.x, std::string(1, ch), color);
+            epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+            timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            resize_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (epoll_fd < 0 || timer_fd < 0 || wake_fd < 0 || resize_fd < 0 || !watch(timer_fd) || !watch(wake_fd) || !watch(resize_fd))
+            {
+                int err = errno;
+                close_fds();
+                throw std::invalid_argument(std::string("\nERROR: Cannot set up the event loop: ") + std::strerror(err));
             }
+            if (options.input_fd >= 0 && !watch(options.input_fd))
+                this->options.input_fd = options.input_fd = -1; // /dev/null or a plain file can't be polled: no input, as after EOF
 
-            void draw_line3D(Window &win, const Point3D &p1, const Point3D &p2, const COLOR& color = COLOR(COLOR::RESET), char ch = '#') {
-                Point2D s = static_cast<Point2D>(p1);
-                Point2D e = static_cast<Point2D>(p2);
+            detail::winch_fd.store(resize_fd);
+            struct sigaction action{};
+            action.sa_handler = detail::on_winch;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESTART;
+            ::sigaction(SIGWINCH, &action, &saved_winch);
 
-                // Bresenham's line algorithm
-                int dx = abs(e.x - s.x), sx = s.x < e.x ? 1 : -1;
-                int dy = -abs(e.y - s.y), sy = s.y < e.y ? 1 : -1;
-                int err = dx + dy, e2;
-
-                int steps = (std::max)(dx, abs(dy)); // we check how many steps it takes to draw the line
-                int current_step = 0; // this will help in interpolation
-
-                while (true) {
-                    // Calculate "Darkness" based on Z
-                    // Linear interpolation of Z: current_z = z1 + (t * (z2 - z1))
-                    float t = (steps == 0) ? 1.0f : (float)current_step / steps;
-                    float current_z = p1.z + t * (p2.z - p1.z);
-
-                    // Map Z to a brightness multiplier (e.g., further = darker)
-                    // Adjust these values based on your scene depth
-                    float brightness = 1.0f / (1.0f + (current_z * 0.1f)); 
-                    COLOR depth_color(
-                        static_cast<uint8_t>(color.r * brightness),
-                        static_cast<uint8_t>(color.g * brightness),
-                        static_cast<uint8_t>(color.b * brightness)
-                    );
+            if (options.raw && options.input_fd >= 0 && ::tcgetattr(options.input_fd, &saved_tty) == 0)
+            {
+                tty_saved = true;
+                termios raw = saved_tty;
+                raw.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+                if (!options.keep_signals)
+                    raw.c_lflag &= ~ISIG;
+                raw.c_iflag &= ~(IXON | ICRNL | INLCR);
+                raw.c_cc[VMIN] = 1;
+                raw.c_cc[VTIME] = 0;
+                ::tcsetattr(options.input_fd, TCSANOW, &raw);
+            }
+            if (options.mouse)
+            {
+                std::lock_guard<std::mutex> lock(screen_lock);
+                sink.write("\033[?1002h\033[?1006h");
+                mouse_on = true;
+            }
+            if (tty_saved || mouse_on)
+            { // otherwise Ctrl+C or a kill would leave the shell without echo and reporting mouse moves
+                detail::quit_signal.store(0);
+                detail::quit_fd.store(wake_fd);
+                action.sa_handler = detail::on_quit;
+                ::sigaction(SIGINT, &action, &saved_int);
+                ::sigaction(SIGTERM, &action, &saved_term);
+                quit_armed = true;
+            }
+        }
+
+        ~EventLoop()
+        {
+            restore_terminal();
+            if (resize_fd >= 0 && detail::winch_fd.load() == resize_fd)
+            {
+                ::sigaction(SIGWINCH, &saved_winch, nullptr);
+                detail::winch_fd.store(-1);
+            }
+            close_fds();
+        }
+
+        EventLoop(const EventLoop &) = delete;
+        EventLoop &operator=(const EventLoop &) = delete;
+
+        // keys and mouse are delivered the moment they arrive, before the frame that follows, so it can show them
+        void on_event(std::function<void(const Event &)> handler) { event_handler = std::move(handler); }
+        void on_frame(std::function<void(const Tick &)> handler) { frame_handler = std::move(handler); }
 
-                    if (s.x >= 0 && s.x < win.get_w() && s.y >= 0 && s.y < win.get_h()) {
-                        win.print(s.y, s.x, std::string(1, ch), depth_color);
+        void set_pacing(Pacing pacing) { options.pacing = pacing; }
+        const Tick &last_tick() const { return tick; }
+
+        // blocks until stop(); handlers run on this thread
+        void run()
+        {
+            running.store(true);
+            timespec now{};
+            ::clock_gettime(CLOCK_MONOTONIC, &now);
+            auto first = nanoseconds(now.tv_sec * 1'000'000'000LL + now.tv_nsec) + period;
+            itimerspec spec{};
+            spec.it_value.tv_sec = static_cast<time_t>(first.count() / 1'000'000'000);
+            spec.it_value.tv_nsec = static_cast<long>(first.count() % 1'000'000'000);
+            spec.it_interval.tv_sec = static_cast<time_t>(period.count() / 1'000'000'000);
+            spec.it_interval.tv_nsec = static_cast<long>(period.count() % 1'000'000'000);
+            ::timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+            last_frame = steady_clock::now();
+
+            epoll_event ready[8];
+            while (running.load(std::memory_order_relaxed))
+            {
+                int timeout = -1;
+                if (parser.waiting())
+                {
+                    auto left = duration_cast<milliseconds>(input_stalled + options.escape_delay - steady_clock::now());
+                    if (left <= milliseconds(0))
+                    {
+                        parser.flush([this](const Event &ev) { emit(ev); });
+                        continue;
                     }
+                    timeout = static_cast<int>(left.count()) + 1;
+                }
+                int n = ::epoll_wait(epoll_fd, ready, 8, timeout);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    break;
+                }
 
-                    if (s.x == e.x && s.y == e.y) break;
-                    e2 = 2 * err;
-                    if (e2 >= dy) { err += dy; s.x += sx; }
-                    if (e2 <= dx) { err += dx; s.y += sy; }
-                    current_step++;
+                // input first, so a frame due in the same wake-up already sees it
+                uint64_t due = 0;
+                for (int k = 0; k < n; k++)
+                {
+                    int fd = ready[k].data.fd;
+                    if (fd == timer_fd)
+                        due = drain_counter(timer_fd);
+                    else if (fd == wake_fd)
+                        drain_counter(wake_fd);
+                    else if (fd == resize_fd)
+                    {
+                        drain_counter(resize_fd);
+                        Event ev;
+                        ev.type = EventType::Resize;
+                        std::tie(ev.cols, ev.rows) = sink.size();
+                        emit(ev);
+                    }
+                    else if (fd == options.input_fd)
+                        read_input();
                 }
+                if (quit_armed && detail::quit_signal.load(std::memory_order_relaxed))
+                    break;
+                if (due && running.load(std::memory_order_relaxed))
+                    run_frames(due);
+            }
+
+            itimerspec off{};
+            ::timerfd_settime(timer_fd, 0, &off, nullptr);
+            running.store(false);
+
+            if (int sig = quit_armed ? detail::quit_signal.exchange(0) : 0)
+            {
+                restore_terminal();
+                ::raise(sig); // the previous disposition, normally the default that ends the process
             }
         }
-    }
+
+        // from any thread or handler; run() returns once the current handler does
+        void stop()
+        {
+            running.store(false);
+            uint64_t one = 1;
+            (void)!::write(wake_fd, &one, sizeof(one));
+        }
+    };
+#endif
 }
\ No newline at end of file
@@ -1,70 +1,58 @@
 #include "echo.hpp"
 #include <vector>
 #include <cmath>
-#include <thread>
 
-int main() {
+int main(int argc, char **argv) {
     using namespace echo;
     using namespace echo::ThreeD;
 
+    // 1. Load the model: an .obj or .ply file from the command line, or the built-in cube
+    // Scale is 10 units
+    float s = 10.0f;
+    Mesh mesh = argc > 1 ? Mesh(argv[1]) : Mesh(
+        VertexBatch(std::vector<Point3D>{
+            {-s, -s, -s}, {s, -s, -s}, {s, s, -s}, {-s, s, -s},
+            {-s, -s,  s}, {s, -s,  s}, {s, s,  s}, {-s, s,  s}
+        }),
+        {},
+        {
+            {0, 3, 2, 1}, {4, 5, 6, 7}, // Back and front faces, counter-clockwise seen from outside
+            {0, 1, 5, 4}, {1, 2, 6, 5}, {2, 3, 7, 6}, {3, 0, 4, 7}
+        });
+
     hide_cursor();
     clear_screen();
 
-    // 1. Setup Window (Full Terminal)
+    // 2. Setup Window (Full Terminal)
     auto [tw, th] = get_terminal_size();
     Window win(1, 1, tw - 1, th - 1, " ECHO 3D ENGINE ");
+    win.enable_depth();
 
-    // 2. Define Cube Vertices (Centered at 0,0,0)
-    // Scale is 10 units
-    float s = 10.0f;
-    std::vector<Point3D> vertices = {
-        {-s, -s, -s}, {s, -s, -s}, {s, s, -s}, {-s, s, -s},
-        {-s, -s,  s}, {s, -s,  s}, {s, s,  s}, {-s, s,  s}
-    };
-
-    // 3. Define Edges (Pairs of vertex indices)
-    std::vector<std::pair<int, int>> edges = {
-        {0, 1}, {1, 2}, {2, 3}, {3, 0}, // Back face
-        {4, 5}, {5, 6}, {6, 7}, {7, 4}, // Front face
-        {0, 4}, {1, 5}, {2, 6}, {3, 7}  // Connecting lines
-    };
+    // 3. Camera far enough back to see the whole model; scratch is reused every frame
+    Point3D center = mesh.center();
+    Camera cam(Point3D(center.x, center.y, center.z - 3.0f * mesh.radius()), center);
+    cam.far_plane = 6.0f * mesh.radius();
+    MeshScratch scratch;
 
     float angle = 0.0f;
-    while (true) {
+    EventLoop loop(60_FPS);
+    loop.on_event([&](const Event &ev) {
+        if (ev.type == EventType::Key && (ev.key == 'q' || ev.key == Event::Escape))
+            loop.stop();
+    });
+    loop.on_frame([&](const Tick &tick) {
         win.clean_buffer();
-        
-        // Center of the window for projection
-        int centerX = win.get_w() / 2;
-        int centerY = win.get_h() / 2;
-
-        // 4. Rotate and Project
-        std::vector<Point3D> rotated;
-        for (auto& v : vertices) {
-            // Use your existing rotate function
-            Point3D r = v.rotate(angle);
-            
-            // Simple Orthographic Projection + Offset to center
-            // (Terminal chars are taller than wide, so we multiply X by 2 for aspect ratio)
-            r.x = (r.x * 2.0f) + centerX;
-            r.y = r.y + centerY;
-            rotated.push_back(r);
-        }
 
-        // 5. Draw Edges using your Bresenham line algorithm
-        for (auto& edge : edges) {
-            Visualizer::Primitive::draw_line(
-                win, 
-                (int)rotated[edge.first].x, (int)rotated[edge.first].y,
-                (int)rotated[edge.second].x, (int)rotated[edge.second].y,
-                COLOR(COLOR::CYAN), '*'
-            );
-        }
+        // 4. Spin about the model's own center; hidden and sub-cell edges are skipped by draw_mesh
+        Mat4 model = Mat4::translate(center.x, center.y, center.z) * Mat4::rotate_x(angle) * Mat4::rotate_y(angle) *
+                     Mat4::translate(-center.x, -center.y, -center.z);
+        Visualizer::ThreeD::draw_mesh(win, cam, model, mesh, scratch, COLOR(COLOR::CYAN), '*');
 
         win.render();
-        angle += 2.0f; 
-        std::this_thread::sleep_for(60_FPS);
-    }
+        angle += 120.0f * duration<float>(tick.dt).count(); // degrees per second, whatever the frame rate
+    });
+    loop.run(); // until q or Esc
 
     reset_cursor();
     return 0;
-}
\ No newline at end of file
+}